@@ -0,0 +1,135 @@
+#!/bin/bash
+
+# Compiles each program in tests/modes in the modes that must not change
+# the generated code, and compares each result with a plain compile.
+
+passed=0 ;
+failed=0 ;
+
+# Compares the given file with the one given after it, or else with the
+# plain compile of the current test.
+check () {
+  cmp -s $2 ${3:-tests/modes/${i}.plain.tmp} ;
+  if ! test $? -eq 0 ; then
+    echo "  $1: Failed" ;
+    let failed=$failed+1 ;
+  else
+    echo "  $1: Passed" ;
+    let passed=$passed+1 ;
+  fi
+}
+
+# Compiles with the given arguments and checks the prog.L1 that results.
+check_compile () {
+  name=$1 ;
+  shift ;
+  rm -f prog.L1 ;
+  ./bin/L2 "$@" &> /dev/null ;
+  check "$name" prog.L1 ;
+}
+
+# Asks the compile server to compile the given file, and prints the L1
+# code if it succeeds.
+request () {
+  python3 - "$1" <<'EOF'
+import socket, sys
+connection = socket.socket(socket.AF_UNIX)
+connection.connect("tests/modes/server.sock.tmp")
+connection.sendall(b"path " + sys.argv[1].encode() + b"\n")
+response = connection.makefile("rb")
+kind, size = response.readline().split()
+if kind == b"ok":
+    sys.stdout.buffer.write(response.read(int(size)))
+EOF
+}
+
+# Start a compile server for the whole run.
+rm -f tests/modes/server.sock.tmp ;
+./bin/L2 --server tests/modes/server.sock.tmp -j 2 &
+server=$! ;
+for attempt in `seq 50` ; do
+  if test -S tests/modes/server.sock.tmp ; then
+    break ;
+  fi
+  sleep 0.1 ;
+done
+
+# Compile all of them at once in batch mode, two at a time.
+ls tests/modes/*.L2 > tests/modes/batch.tmp ;
+./bin/L2 --batch tests/modes/batch.tmp -j 2 ;
+
+cd tests/modes ;
+for i in *.L2 ; do
+  echo $i ;
+  pushd ./ > /dev/null ;
+  cd ../../ ;
+  rm -f prog.L1 ;
+  ./bin/L2 tests/modes/${i} ;
+  mv prog.L1 tests/modes/${i}.plain.tmp ;
+
+  # Serialized IR
+  ./bin/L2 -w tests/modes/${i}.L2b.tmp tests/modes/${i} ;
+  check_compile ".L2b round trip" tests/modes/${i}.L2b.tmp ;
+
+  # Parallel parsing
+  check_compile "-j" -j 4 tests/modes/${i} ;
+
+  # Lazy parsing
+  check_compile "-L" -L tests/modes/${i} ;
+  rm -f prog.L1 ;
+  ./bin/L2 --reachable-only tests/modes/${i} ;
+  mv prog.L1 tests/modes/${i}.reachable.tmp ;
+  rm -f prog.L1 ;
+  ./bin/L2 -L --reachable-only tests/modes/${i} &> /dev/null ;
+  check "-L --reachable-only" prog.L1 tests/modes/${i}.reachable.tmp ;
+
+  # Streaming
+  check_compile "-F" -F tests/modes/${i} ;
+
+  # Batch, from above; each output is named after its input
+  mv tests/modes/${i%.L2}.L1 tests/modes/${i}.batch.tmp ;
+  check "--batch" tests/modes/${i}.batch.tmp ;
+
+  # Server; the second request is answered from its cache
+  request tests/modes/${i} > tests/modes/${i}.server.tmp ;
+  check "--server" tests/modes/${i}.server.tmp ;
+  request tests/modes/${i} > tests/modes/${i}.server.tmp ;
+  check "--server, cached" tests/modes/${i}.server.tmp ;
+
+  # On-disk cache, first empty and then full
+  cache=tests/modes/${i}.cache.tmp ;
+  rm -fr $cache ;
+  check_compile "--cache-dir, empty" --cache-dir $cache tests/modes/${i} ;
+  check_compile "--cache-dir, full" --cache-dir $cache tests/modes/${i} ;
+
+  # Swap two entries, as if their keys had hashed to the same name; the
+  # cache must notice that the keys differ rather than use the wrong code
+  entries=(`ls $cache`) ;
+  if test ${#entries[@]} -ge 2 ; then
+    mv $cache/${entries[0]} $cache/swap ;
+    mv $cache/${entries[1]} $cache/${entries[0]} ;
+    mv $cache/swap $cache/${entries[1]} ;
+    check_compile "--cache-dir, colliding keys" --cache-dir $cache tests/modes/${i} ;
+  fi
+
+  # Separate compilation: tests/modes/modules/NAME holds the functions of
+  # NAME.L2 split into modules, numbered so that linking them in name
+  # order keeps the functions in the order of the program
+  modules=tests/modes/modules/${i%.L2} ;
+  if test -d $modules ; then
+    for module in $modules/*.L2 ; do
+      ./bin/L2 --module $module ;
+    done
+    entry=`head -n 1 tests/modes/${i}.plain.tmp | sed "s/^(@//"` ;
+    check_compile "--module, --link" --link $entry $modules/*.L1m ;
+    rm -f $modules/*.L1m ;
+  fi
+
+  popd > /dev/null ;
+done
+cd ../../ ;
+kill $server ;
+let total=$passed+$failed ;
+
+echo "########## SUMMARY" ;
+echo "Test passed: $passed out of $total"
@@ -0,0 +1,23 @@
+#!/bin/bash
+
+# Runs each test in tests/unit, built by make test_units as bin/unit_NAME.
+# A test prints the checks that failed and exits with a non-zero status.
+
+passed=0 ;
+failed=0 ;
+for i in tests/unit/*.cpp ; do
+  name=`basename $i .cpp` ;
+  echo $name ;
+  ./bin/unit_${name} ;
+  if ! test $? -eq 0 ; then
+    echo "  Failed" ;
+    let failed=$failed+1 ;
+  else
+    echo "  Passed" ;
+    let passed=$passed+1 ;
+  fi
+done
+let total=$passed+$failed ;
+
+echo "########## SUMMARY" ;
+echo "Test passed: $passed out of $total"
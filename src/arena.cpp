@@ -0,0 +1,270 @@
+#include "arena.h"
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <sys/mman.h>
+
+namespace L2::arena {
+	const std::size_t first_chunk_size = 4096;
+	const std::size_t huge_page_size = 2 * 1024 * 1024;
+	const std::size_t alignment = alignof(std::max_align_t);
+
+	const std::size_t first_scratch_size = 64 * 1024;
+	const std::size_t max_scratch_size = 64 * 1024 * 1024;
+	const std::size_t scratch_shrink_interval = 64; // rounds
+
+	std::atomic<bool> huge_pages_enabled = false;
+	thread_local Arena *current_arena = nullptr;
+	thread_local ChunkPool *current_pool = nullptr;
+	thread_local Scratch *current_scratch = nullptr;
+
+	std::size_t align_up(std::size_t size, std::size_t to) {
+		return (size + to - 1) / to * to;
+	}
+
+	Arena::Arena() :
+		chunks {},
+		pos {nullptr},
+		end {nullptr},
+		next_chunk_size {first_chunk_size}
+	{}
+
+	Arena::~Arena() {
+		this->release();
+	}
+
+	void *Arena::allocate(std::size_t size) {
+		size = align_up(size, alignment);
+		if (static_cast<std::size_t>(this->end - this->pos) < size) {
+			this->add_chunk(size);
+		}
+		void *result = this->pos;
+		this->pos += size;
+		return result;
+	}
+
+	void free_chunk(const Chunk &chunk) {
+		if (chunk.mapped) {
+			munmap(chunk.data, chunk.size);
+		} else {
+			::operator delete(chunk.data);
+		}
+	}
+
+	void Arena::release() {
+		for (const Chunk &chunk : this->chunks) {
+			if (!current_pool || !current_pool->give(chunk)) {
+				free_chunk(chunk);
+			}
+		}
+		this->chunks.clear();
+		this->pos = nullptr;
+		this->end = nullptr;
+		this->next_chunk_size = first_chunk_size;
+	}
+
+	void Arena::add_chunk(std::size_t min_size) {
+		// grow geometrically so that big functions use few chunks
+		std::size_t size = std::max(this->next_chunk_size, min_size);
+		this->next_chunk_size = std::min(this->next_chunk_size * 2, huge_page_size);
+
+		if (current_pool) {
+			if (std::optional<Chunk> chunk = current_pool->take(size)) {
+				this->chunks.push_back(*chunk);
+				this->pos = chunk->data;
+				this->end = chunk->data + chunk->size;
+				return;
+			}
+		}
+
+		Chunk chunk {nullptr, size, false};
+		if (huge_pages_enabled && size >= huge_page_size) {
+			chunk.size = align_up(size, huge_page_size);
+			void *data = mmap(nullptr, chunk.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (data != MAP_FAILED) {
+				// only a hint; the kernel may not have huge pages to give
+				madvise(data, chunk.size, MADV_HUGEPAGE);
+				chunk.data = static_cast<char *>(data);
+				chunk.mapped = true;
+			} else {
+				chunk.size = size;
+			}
+		}
+		if (!chunk.data) {
+			chunk.data = static_cast<char *>(::operator new(chunk.size));
+		}
+		this->chunks.push_back(chunk);
+		this->pos = chunk.data;
+		this->end = chunk.data + chunk.size;
+	}
+
+	UseArena::UseArena(Arena *arena) : previous {current_arena} {
+		current_arena = arena;
+	}
+
+	UseArena::~UseArena() {
+		current_arena = this->previous;
+	}
+
+	ChunkPool::ChunkPool(std::size_t max_bytes) :
+		chunks {},
+		bytes {0},
+		max_bytes {max_bytes}
+	{}
+
+	ChunkPool::~ChunkPool() {
+		for (const Chunk &chunk : this->chunks) {
+			free_chunk(chunk);
+		}
+	}
+
+	std::optional<Chunk> ChunkPool::take(std::size_t min_size) {
+		// the smallest that fits, so that big chunks are left for big
+		// functions
+		auto best = this->chunks.end();
+		for (auto it = this->chunks.begin(); it != this->chunks.end(); ++it) {
+			if (it->size >= min_size && (best == this->chunks.end() || it->size < best->size)) {
+				best = it;
+			}
+		}
+		if (best == this->chunks.end()) {
+			return {};
+		}
+		Chunk chunk = *best;
+		*best = this->chunks.back();
+		this->chunks.pop_back();
+		this->bytes -= chunk.size;
+		return chunk;
+	}
+
+	bool ChunkPool::give(const Chunk &chunk) {
+		if (this->bytes + chunk.size > this->max_bytes) {
+			return false;
+		}
+		this->chunks.push_back(chunk);
+		this->bytes += chunk.size;
+		return true;
+	}
+
+	UseChunkPool::UseChunkPool(ChunkPool *pool) : previous {current_pool} {
+		current_pool = pool;
+	}
+
+	UseChunkPool::~UseChunkPool() {
+		current_pool = this->previous;
+	}
+
+	void set_huge_pages(bool enabled) {
+		huge_pages_enabled = enabled;
+	}
+
+	// Every node is preceded by a header recording whether it came from an
+	// arena, so that free_node knows whether there is anything to free. The
+	// header is a full alignment unit so that the node stays aligned.
+	enum struct NodeOrigin : unsigned char {
+		heap,
+		arena
+	};
+
+	void *allocate_node(std::size_t size) {
+		char *block;
+		NodeOrigin origin;
+		if (current_arena) {
+			block = static_cast<char *>(current_arena->allocate(alignment + size));
+			origin = NodeOrigin::arena;
+		} else {
+			block = static_cast<char *>(::operator new(alignment + size));
+			origin = NodeOrigin::heap;
+		}
+		*reinterpret_cast<NodeOrigin *>(block) = origin;
+		return block + alignment;
+	}
+
+	void free_node(void *ptr) {
+		if (!ptr) {
+			return;
+		}
+		char *block = static_cast<char *>(ptr) - alignment;
+		if (*reinterpret_cast<NodeOrigin *>(block) == NodeOrigin::heap) {
+			::operator delete(block);
+		}
+	}
+
+	void *Scratch::Counter::do_allocate(std::size_t bytes, std::size_t alignment) {
+		this->used += align_up(bytes, alignment);
+		return this->upstream->allocate(bytes, alignment);
+	}
+
+	void Scratch::Counter::do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) {
+		this->upstream->deallocate(ptr, bytes, alignment);
+	}
+
+	bool Scratch::Counter::do_is_equal(const std::pmr::memory_resource &other) const noexcept {
+		return this == &other;
+	}
+
+	Scratch::Scratch() :
+		buffer {new std::byte[first_scratch_size]},
+		buffer_size {first_scratch_size},
+		resource {},
+		counter {},
+		recent_peak {0},
+		rounds {0}
+	{
+		this->resource.emplace(this->buffer.get(), this->buffer_size, std::pmr::new_delete_resource());
+		this->counter.upstream = &*this->resource;
+	}
+
+	std::pmr::memory_resource *Scratch::get_resource() {
+		return &this->counter;
+	}
+
+	void Scratch::reset() {
+		// hand the overflow back to the heap
+		this->resource.reset();
+		std::size_t used = this->counter.used;
+		this->counter.used = 0;
+		this->recent_peak = std::max(this->recent_peak, used);
+		++this->rounds;
+
+		std::size_t new_size = this->buffer_size;
+		if (used > this->buffer_size) {
+			// the last round did not fit; make the buffer big enough for it
+			new_size = std::min(align_up(used, first_scratch_size), max_scratch_size);
+		} else if (this->rounds >= scratch_shrink_interval && this->recent_peak <= this->buffer_size / 2) {
+			// recent rounds have left most of the buffer unused
+			new_size = std::max(align_up(this->recent_peak, first_scratch_size), first_scratch_size);
+		}
+		bool resized = new_size != this->buffer_size;
+		if (resized) {
+			this->buffer_size = new_size;
+			this->buffer.reset(new std::byte[this->buffer_size]);
+		}
+		if (resized || this->rounds >= scratch_shrink_interval) {
+			this->recent_peak = 0;
+			this->rounds = 0;
+		}
+		this->resource.emplace(this->buffer.get(), this->buffer_size, std::pmr::new_delete_resource());
+		this->counter.upstream = &*this->resource;
+	}
+
+	Scratch &thread_scratch() {
+		thread_local Scratch scratch;
+		return scratch;
+	}
+
+	UseScratch::UseScratch(Scratch *scratch) : previous {current_scratch} {
+		current_scratch = scratch;
+	}
+
+	UseScratch::~UseScratch() {
+		current_scratch = this->previous;
+	}
+
+	std::pmr::memory_resource *scratch_resource() {
+		if (current_scratch) {
+			return current_scratch->get_resource();
+		}
+		return std::pmr::new_delete_resource();
+	}
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <vector>
+
+// Bump allocation for IR nodes. Each L2Function owns an Arena, and the
+// Expr and Instruction nodes created while it is the thread's current arena
+// are carved out of it instead of being allocated one by one. Deleting such
+// a node only runs its destructor; its memory is released all at once with
+// the Arena. Nodes created while no arena is current come from the heap as
+// usual, so both kinds can be mixed freely in one function.
+//
+// A node must not outlive the Arena it was allocated in.
+namespace L2::arena {
+	struct Chunk {
+		char *data;
+		std::size_t size;
+		bool mapped; // allocated with mmap rather than operator new
+	};
+
+	class Arena {
+		private:
+
+		std::vector<Chunk> chunks;
+		char *pos;
+		char *end;
+		std::size_t next_chunk_size;
+
+		public:
+
+		Arena();
+		Arena(const Arena &other) = delete;
+		Arena &operator=(const Arena &other) = delete;
+		~Arena();
+
+		// returns memory aligned for any type
+		void *allocate(std::size_t size);
+		// frees all memory allocated so far, handing the chunks to the
+		// current ChunkPool if there is one
+		void release();
+
+		private:
+
+		void add_chunk(std::size_t min_size);
+	};
+
+	// Makes the given arena (or none) the current one on this thread until
+	// this object is destroyed.
+	class UseArena {
+		private:
+
+		Arena *previous;
+
+		public:
+
+		UseArena(Arena *arena);
+		UseArena(const UseArena &other) = delete;
+		~UseArena();
+	};
+
+	// The chunks of released Arenas, kept so that Arenas created later on
+	// the same thread take them instead of going to the heap. A worker of
+	// the compile server keeps one for as long as it lives, so that the
+	// functions of each request reuse the memory of the requests before it.
+	// Holds at most max_bytes; chunks beyond that are freed.
+	class ChunkPool {
+		private:
+
+		std::vector<Chunk> chunks;
+		std::size_t bytes;
+		std::size_t max_bytes;
+
+		public:
+
+		explicit ChunkPool(std::size_t max_bytes);
+		ChunkPool(const ChunkPool &other) = delete;
+		ChunkPool &operator=(const ChunkPool &other) = delete;
+		~ChunkPool();
+
+		// removes and returns a chunk of at least the given size, if any
+		std::optional<Chunk> take(std::size_t min_size);
+		// keeps the chunk if there is room for it; returns whether it did
+		bool give(const Chunk &chunk);
+	};
+
+	// Makes the given ChunkPool (or none) the one that Arenas use on this
+	// thread until this object is destroyed.
+	class UseChunkPool {
+		private:
+
+		ChunkPool *previous;
+
+		public:
+
+		UseChunkPool(ChunkPool *pool);
+		UseChunkPool(const UseChunkPool &other) = delete;
+		~UseChunkPool();
+	};
+
+	// Backs chunks of at least the huge page size with transparent huge
+	// pages, which only the biggest functions will reach. Off by default.
+	void set_huge_pages(bool enabled);
+
+	// used by the operator new/delete of IR nodes
+	void *allocate_node(std::size_t size);
+	void free_node(void *ptr);
+
+	// Memory for the temporary containers of a pass, such as the liveness
+	// sets and the interference graph of one allocation round. It is a
+	// std::pmr::monotonic_buffer_resource over a buffer that is kept between
+	// rounds: reset() frees everything at once in O(1), and the buffer is
+	// sized to the most that recent rounds used, so that later rounds (and
+	// later functions) don't go to the heap at all. The buffer is capped, and
+	// shrinks again once a big function has gone by.
+	class Scratch {
+		private:
+
+		// passes allocations through to the monotonic resource, counting
+		// the bytes that are asked for
+		class Counter : public std::pmr::memory_resource {
+			public:
+
+			std::pmr::memory_resource *upstream = nullptr;
+			std::size_t used = 0;
+
+			private:
+
+			virtual void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+			virtual void do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override;
+			virtual bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+		};
+
+		std::unique_ptr<std::byte[]> buffer;
+		std::size_t buffer_size;
+		std::optional<std::pmr::monotonic_buffer_resource> resource; // goes to the heap once the buffer is full
+		Counter counter; // in front of this->resource
+		std::size_t recent_peak; // the most that a round has used since this->rounds was reset
+		std::size_t rounds; // rounds since the buffer was last resized or found to fit
+
+		public:
+
+		Scratch();
+		Scratch(const Scratch &other) = delete;
+		Scratch &operator=(const Scratch &other) = delete;
+
+		std::pmr::memory_resource *get_resource();
+		// Frees everything allocated so far. Nothing allocated from this
+		// Scratch may be alive.
+		void reset();
+	};
+
+	// the calling thread's Scratch, which lives as long as the thread
+	Scratch &thread_scratch();
+
+	// Makes the given Scratch (or none) the one that ScratchAllocators
+	// created on this thread use, until this object is destroyed.
+	class UseScratch {
+		private:
+
+		Scratch *previous;
+
+		public:
+
+		UseScratch(Scratch *scratch);
+		UseScratch(const UseScratch &other) = delete;
+		~UseScratch();
+	};
+
+	// the resource of the current Scratch, or the heap if there is none
+	std::pmr::memory_resource *scratch_resource();
+
+	// An allocator that uses the Scratch that was current when it was
+	// created (or copied into a new container), so that containers of
+	// temporaries pick it up without having it passed down to them.
+	template<typename T>
+	class ScratchAllocator {
+		public:
+
+		using value_type = T;
+
+		std::pmr::memory_resource *resource;
+
+		ScratchAllocator() : resource {scratch_resource()} {}
+		template<typename U>
+		ScratchAllocator(const ScratchAllocator<U> &other) : resource {other.resource} {}
+
+		T *allocate(std::size_t n) {
+			return static_cast<T *>(this->resource->allocate(n * sizeof(T), alignof(T)));
+		}
+		void deallocate(T *ptr, std::size_t n) {
+			this->resource->deallocate(ptr, n * sizeof(T), alignof(T));
+		}
+		ScratchAllocator select_on_container_copy_construction() const {
+			return ScratchAllocator();
+		}
+
+		template<typename U>
+		bool operator==(const ScratchAllocator<U> &other) const { return this->resource == other.resource; }
+		template<typename U>
+		bool operator!=(const ScratchAllocator<U> &other) const { return this->resource != other.resource; }
+	};
+
+	template<typename T>
+	using ScratchVector = std::vector<T, ScratchAllocator<T>>;
+}
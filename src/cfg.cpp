@@ -0,0 +1,106 @@
+#include "cfg.h"
+#include <utility>
+
+namespace L2::program::analyze {
+	// whether the instruction is the last of its basic block
+	bool ends_block(const compact::CompactInstruction &inst) {
+		using compact::Opcode;
+		switch (inst.opcode) {
+			case Opcode::ret:
+			case Opcode::jump:
+			case Opcode::cjump:
+				return true;
+			case Opcode::call:
+				return inst.never_returns;
+			default:
+				return false;
+		}
+	}
+
+	void add_edge(ControlFlowGraph &cfg, std::size_t from, std::size_t to) {
+		for (std::size_t succ : cfg.blocks[from].successors) {
+			if (succ == to) {
+				return;
+			}
+		}
+		cfg.blocks[from].successors.push_back(to);
+		cfg.blocks[to].predecessors.push_back(from);
+	}
+
+	void number_blocks(ControlFlowGraph &cfg) {
+		std::size_t num_blocks = cfg.blocks.size();
+		arena::ScratchVector<bool> visited(num_blocks, false);
+		arena::ScratchVector<std::size_t> postorder;
+		postorder.reserve(num_blocks);
+
+		// depth-first search from the entry; each stack entry is a block and
+		// the index of the next successor to visit
+		arena::ScratchVector<std::pair<std::size_t, std::size_t>> stack;
+		if (num_blocks > 0) {
+			stack.push_back({0, 0});
+			visited[0] = true;
+		}
+		while (!stack.empty()) {
+			auto &[block, next_succ] = stack.back();
+			const arena::ScratchVector<std::size_t> &successors = cfg.blocks[block].successors;
+			if (next_succ < successors.size()) {
+				std::size_t succ = successors[next_succ++];
+				if (!visited[succ]) {
+					visited[succ] = true;
+					stack.push_back({succ, 0});
+				}
+			} else {
+				postorder.push_back(block);
+				stack.pop_back();
+			}
+		}
+
+		cfg.order.assign(postorder.rbegin(), postorder.rend());
+		for (std::size_t block = 0; block < num_blocks; ++block) {
+			if (!visited[block]) {
+				cfg.order.push_back(block);
+			}
+		}
+		for (std::size_t i = 0; i < cfg.order.size(); ++i) {
+			cfg.blocks[cfg.order[i]].rpo_number = i;
+		}
+	}
+
+	ControlFlowGraph build_cfg(const compact::CompactFunction &function) {
+		using compact::Opcode;
+		const arena::ScratchVector<compact::CompactInstruction> &instructions = function.instructions;
+		std::size_t num_instructions = instructions.size();
+		ControlFlowGraph cfg;
+		cfg.block_of.resize(num_instructions);
+
+		// split into blocks
+		for (std::size_t i = 0; i < num_instructions; ++i) {
+			bool starts_block = i == 0
+				|| instructions[i].opcode == Opcode::label
+				|| ends_block(instructions[i - 1]);
+			if (starts_block) {
+				if (!cfg.blocks.empty()) {
+					cfg.blocks.back().end = i;
+				}
+				cfg.blocks.push_back(BasicBlock {i, num_instructions, {}, {}, 0});
+			}
+			cfg.block_of[i] = cfg.blocks.size() - 1;
+		}
+
+		// connect them; falling off the end of the function has no successor
+		for (std::size_t block = 0; block < cfg.blocks.size(); ++block) {
+			std::size_t end = cfg.blocks[block].end;
+			const compact::CompactInstruction &last = instructions[end - 1];
+			bool falls_through = !ends_block(last) || last.opcode == Opcode::cjump;
+			if (falls_through && end < num_instructions) {
+				add_edge(cfg, block, cfg.block_of[end]);
+			}
+			if (last.opcode == Opcode::jump || last.opcode == Opcode::cjump) {
+				add_edge(cfg, block, cfg.block_of[last.target]);
+			}
+		}
+
+		number_blocks(cfg);
+		return cfg;
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "compact_ir.h"
+#include <vector>
+
+namespace L2::program::analyze {
+	// A maximal run of instructions that is only entered at its first
+	// instruction and only left after its last one.
+	struct BasicBlock {
+		std::size_t begin; // the ordinal of the first instruction
+		std::size_t end; // one past the ordinal of the last instruction
+		arena::ScratchVector<std::size_t> successors; // block ids
+		arena::ScratchVector<std::size_t> predecessors; // block ids
+		std::size_t rpo_number; // the position of this block in ControlFlowGraph::order
+	};
+
+	// The basic blocks of a function, built from its compact encoding. Blocks
+	// start at labels and after jumps, returns, and calls that never return;
+	// block 0 is the entry. Building one is linear in the number of
+	// instructions, so it is simply built again after spilling.
+	struct ControlFlowGraph {
+		arena::ScratchVector<BasicBlock> blocks; // in instruction order
+		arena::ScratchVector<std::size_t> block_of; // the block id of each instruction ordinal
+		// block ids in reverse postorder from the entry, followed by the
+		// unreachable blocks in instruction order
+		arena::ScratchVector<std::size_t> order;
+	};
+
+	ControlFlowGraph build_cfg(const compact::CompactFunction &function);
+}
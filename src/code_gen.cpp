@@ -3,6 +3,7 @@
 #include "register_allocator.h"
 #include <iostream>
 #include <fstream>
+#include <sstream>
 
 namespace L2::code_gen {
 	using namespace L2::program;
@@ -46,7 +47,7 @@ namespace L2::code_gen {
 			o << ":" << expr.get_ref_name();
 		}
 		virtual void visit(VariableRef &expr) {
-			o << this->reg_alloc_map.at(expr.get_referent())->name;
+			o << this->reg_alloc_map[expr.get_referent()->index]->name;
 		}
 		virtual void visit(L2FunctionRef &expr) {
 			o << "@" << expr.get_referent()->get_name();
@@ -141,27 +142,79 @@ namespace L2::code_gen {
 		return sol;
 	}
 
-	void generate_code(Program &p){
+	// allocates registers for the function and writes its L1 code
+	void allocate_and_generate_function_code(Program &p, L2Function &f, std::ostream &o) {
+		// the spiller's new nodes belong to the function too
+		arena::UseArena use_arena(&f.arena);
+		analyze::RegAllocMap reg_alloc_map =
+			analyze::allocate_and_spill_with_backup(f);
+		int spill_overflow = get_spill_overflow(f);
+		InstructionCodeGenVisitor v(f, p, o, spill_overflow, reg_alloc_map);
+		o << "\t(@" << f.get_name();
+		o << " " << f.get_num_arguments();
+		o << " " << std::to_string(spill_overflow) << "\n";
+		for (const auto &inst : f.instructions) {
+			inst->accept(v);
+		}
+		o << "\t ) \n";
+	}
+
+	void generate_function_code(Program &p, L2Function &f, std::ostream &o, FunctionCodeCache *cache) {
+		if (!cache) {
+			allocate_and_generate_function_code(p, f, o);
+			return;
+		}
+
+		std::string key = f.to_string();
+		if (std::optional<std::string> code = cache->get(key)) {
+			o << *code;
+			return;
+		}
+		std::ostringstream code;
+		allocate_and_generate_function_code(p, f, code);
+		cache->put(key, code.str());
+		o << code.str();
+	}
+
+	void generate_code(Program &p, std::ostream &o, bool reachable_only, FunctionCodeCache *cache) {
+		o << "(@" << p.get_entry_function_ref().get_referent()->get_name() << "\n";
+
+		std::vector<L2Function *> functions;
+		if (reachable_only) {
+			functions = p.get_reachable_l2_functions();
+		} else {
+			for (std::size_t i = 0; i < p.get_l2_functions().size(); ++i) {
+				functions.push_back(p.get_l2_function(i));
+			}
+		}
+		for (L2Function *f : functions) {
+			generate_function_code(p, *f, o, cache);
+		}
+		o << ")\n";
+	}
+
+	void generate_code(Program &p, bool reachable_only, FunctionCodeCache *cache){
 		std::ofstream o;
 		o.open("prog.L1");
+		generate_code(p, o, reachable_only, cache);
+		o.close();
+	}
 
+	void generate_code_streaming(Program &p, std::ostream &o, FunctionCodeCache *cache) {
 		o << "(@" << p.get_entry_function_ref().get_referent()->get_name() << "\n";
 
-		for (const std::unique_ptr<L2Function> &f : p.get_l2_functions()) {
-			analyze::RegAllocMap reg_alloc_map =
-				analyze::allocate_and_spill_with_backup(*f);
-            int spill_overflow = get_spill_overflow(*f);
-			InstructionCodeGenVisitor v(*f, p, o, spill_overflow, reg_alloc_map);
-			o << "\t(@" << f->get_name();
-			o << " " << f->get_num_arguments();
-			o << " " << std::to_string(spill_overflow) << "\n";
-            for (const auto &inst : f->instructions) {
-                inst->accept(v);
-            }
-			o << "\t ) \n";
+		for (std::size_t i = 0; i < p.get_l2_functions().size(); ++i) {
+			L2Function *f = p.get_l2_function(i);
+			generate_function_code(p, *f, o, cache);
+			f->release_body();
 		}
 		o << ")\n";
+	}
 
+	void generate_code_streaming(Program &p, FunctionCodeCache *cache) {
+		std::ofstream o;
+		o.open("prog.L1");
+		generate_code_streaming(p, o, cache);
 		o.close();
 	}
-}
\ No newline at end of file
+}
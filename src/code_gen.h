@@ -1,6 +1,30 @@
 #pragma once
 #include "program.h"
+#include <ostream>
+#include <optional>
+#include <string>
 
 namespace L2::code_gen {
-    void generate_code(L2::program::Program &p);
+    // Remembers the L1 code generated for functions, keyed by the L2 text of
+    // the function (which determines its code), so that compiling the same
+    // function again can skip register allocation.
+    class FunctionCodeCache {
+        public:
+
+        virtual ~FunctionCodeCache() = default;
+        virtual std::optional<std::string> get(const std::string &key) = 0;
+        virtual void put(const std::string &key, const std::string &code) = 0;
+    };
+
+    // allocates registers for one function and emits its code, unless the
+    // code is found in the cache
+    void generate_function_code(L2::program::Program &p, L2::program::L2Function &f, std::ostream &o, FunctionCodeCache *cache = nullptr);
+    // If reachable_only, emits only the functions reachable from the entry
+    // function, so that in lazy mode the other bodies are never parsed.
+    void generate_code(L2::program::Program &p, std::ostream &o, bool reachable_only = false, FunctionCodeCache *cache = nullptr);
+    void generate_code(L2::program::Program &p, bool reachable_only = false, FunctionCodeCache *cache = nullptr); // writes prog.L1
+    // Materializes, emits, and then releases one function at a time, so that
+    // with a lazily parsed program only one body is in memory at once.
+    void generate_code_streaming(L2::program::Program &p, std::ostream &o, FunctionCodeCache *cache = nullptr);
+    void generate_code_streaming(L2::program::Program &p, FunctionCodeCache *cache = nullptr); // writes prog.L1
 }
@@ -0,0 +1,130 @@
+#include "compact_ir.h"
+
+namespace L2::program::compact {
+	class OperandEncoder : public ExprVisitor {
+		private:
+
+		Operand result;
+
+		public:
+
+		bool never_returns; // whether the last operand encoded was a function that never returns
+
+		Operand encode(Expr &expr) {
+			this->result = Operand {};
+			this->never_returns = false;
+			expr.accept(*this);
+			return this->result;
+		}
+
+		virtual void visit(RegisterRef &expr) override {
+			const Register *reg = expr.get_referent();
+			this->result.kind = reg->ignores_liveness ? OperandKind::untracked_register : OperandKind::variable;
+			this->result.id = reg->index;
+		}
+		virtual void visit(NumberLiteral &expr) override {
+			this->result.kind = OperandKind::number;
+			this->result.value = expr.value;
+		}
+		virtual void visit(StackArg &expr) override {
+			this->result.kind = OperandKind::stack_arg;
+			this->result.value = expr.stack_num->value;
+		}
+		virtual void visit(MemoryLocation &expr) override {
+			Operand base = this->encode(*expr.base);
+			this->result.kind = OperandKind::memory;
+			this->result.id = base.kind == OperandKind::variable ? base.id : no_variable;
+			this->result.value = expr.offset->value;
+		}
+		virtual void visit(LabelRef &expr) override {
+			this->result.kind = OperandKind::label;
+			this->result.id = expr.get_referent()->ordinal;
+		}
+		virtual void visit(VariableRef &expr) override {
+			this->result.kind = OperandKind::variable;
+			this->result.id = expr.get_referent()->index;
+		}
+		virtual void visit(L2FunctionRef &expr) override {
+			this->result.kind = OperandKind::l2_function;
+			this->never_returns = expr.get_referent()->get_never_returns();
+		}
+		virtual void visit(ExternalFunctionRef &expr) override {
+			this->result.kind = OperandKind::external_function;
+			this->never_returns = expr.get_referent()->get_never_returns();
+		}
+	};
+
+	class InstructionEncoder : public InstructionVisitor {
+		private:
+
+		OperandEncoder operand_encoder;
+		CompactInstruction result;
+
+		public:
+
+		CompactInstruction encode(Instruction &inst) {
+			this->result = CompactInstruction {};
+			inst.accept(*this);
+			return this->result;
+		}
+
+		virtual void visit(InstructionReturn &inst) override {
+			this->result.opcode = Opcode::ret;
+		}
+		virtual void visit(InstructionAssignment &inst) override {
+			this->result.opcode = Opcode::assign;
+			this->result.assign_op = inst.op;
+			this->result.operands[0] = this->operand_encoder.encode(*inst.destination);
+			this->result.operands[1] = this->operand_encoder.encode(*inst.source);
+		}
+		virtual void visit(InstructionCompareAssignment &inst) override {
+			this->result.opcode = Opcode::compare_assign;
+			this->result.compare_op = inst.op;
+			this->result.operands[0] = this->operand_encoder.encode(*inst.destination);
+			this->result.operands[1] = this->operand_encoder.encode(*inst.lhs);
+			this->result.operands[2] = this->operand_encoder.encode(*inst.rhs);
+		}
+		virtual void visit(InstructionCompareJump &inst) override {
+			this->result.opcode = Opcode::cjump;
+			this->result.compare_op = inst.op;
+			this->result.operands[0] = this->operand_encoder.encode(*inst.lhs);
+			this->result.operands[1] = this->operand_encoder.encode(*inst.rhs);
+			this->result.target = inst.label->get_referent()->ordinal;
+		}
+		virtual void visit(InstructionLabel &inst) override {
+			this->result.opcode = Opcode::label;
+		}
+		virtual void visit(InstructionGoto &inst) override {
+			this->result.opcode = Opcode::jump;
+			this->result.target = inst.label->get_referent()->ordinal;
+		}
+		virtual void visit(InstructionCall &inst) override {
+			this->result.opcode = Opcode::call;
+			this->result.immediate = inst.num_arguments;
+			this->result.operands[0] = this->operand_encoder.encode(*inst.callee);
+			this->result.never_returns = this->operand_encoder.never_returns;
+		}
+		virtual void visit(InstructionLeaq &inst) override {
+			this->result.opcode = Opcode::leaq;
+			this->result.immediate = inst.scale;
+			this->result.operands[0] = this->operand_encoder.encode(*inst.destination);
+			this->result.operands[1] = this->operand_encoder.encode(*inst.base);
+			this->result.operands[2] = this->operand_encoder.encode(*inst.offset);
+		}
+	};
+
+	CompactFunction encode(L2Function &function) {
+		CompactFunction result;
+		function.number_instructions();
+		std::vector<Variable *> variables = function.number_variables();
+		result.variables.assign(variables.begin(), variables.end());
+		result.num_variables = variables.size() - function.agg_scope.register_scope.get_all_items().size();
+
+		InstructionEncoder encoder;
+		result.instructions.reserve(function.instructions.size());
+		for (const std::unique_ptr<Instruction> &inst : function.instructions) {
+			result.instructions.push_back(encoder.encode(*inst));
+		}
+		return result;
+	}
+}
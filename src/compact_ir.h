@@ -0,0 +1,65 @@
+#pragma once
+#include "program.h"
+#include <cstdint>
+#include <vector>
+
+// A flat encoding of a function's instructions for the analysis passes.
+// Every instruction is a fixed-size record in one contiguous array, with its
+// operands stored inline as numbers (variable indices, immediates, jump
+// targets) instead of as pointers to Exprs, so that passes can dispatch
+// with a switch and stream through memory. It is a read-only view: it has
+// to be encoded again after the function changes.
+namespace L2::program::compact {
+	enum struct OperandKind : uint8_t {
+		none,
+		variable, // a Variable or a Register whose liveness is tracked
+		untracked_register, // a Register that ignores liveness (rsp)
+		number,
+		memory, // a base variable and an offset
+		stack_arg,
+		label,
+		l2_function,
+		external_function
+	};
+
+	const uint32_t no_variable = UINT32_MAX;
+
+	struct Operand {
+		OperandKind kind = OperandKind::none;
+		// the Variable::index for variable, untracked_register, and memory
+		// (no_variable if the base is untracked)
+		uint32_t id = no_variable;
+		// number: the value; memory: the offset; stack_arg: the stack number
+		int64_t value = 0;
+	};
+
+	enum struct Opcode : uint8_t {
+		ret,
+		assign, // operands: destination, source
+		compare_assign, // operands: destination, lhs, rhs
+		cjump, // operands: lhs, rhs
+		label,
+		jump, // goto
+		call, // operands: callee
+		leaq // operands: destination, base, offset
+	};
+
+	struct CompactInstruction {
+		Opcode opcode;
+		bool never_returns = false; // for calls
+		AssignOperator assign_op = AssignOperator::pure;
+		ComparisonOperator compare_op = ComparisonOperator::eq;
+		uint32_t target = 0; // the ordinal of the label that cjump and jump go to
+		int64_t immediate = 0; // call: the number of arguments; leaq: the scale
+		Operand operands[3];
+	};
+
+	struct CompactFunction {
+		arena::ScratchVector<CompactInstruction> instructions; // indexed by Instruction::ordinal
+		arena::ScratchVector<const Variable *> variables; // indexed by Variable::index
+		std::size_t num_variables; // variables[0, num_variables) are Variables, the rest Registers
+	};
+
+	// numbers the function's instructions and variables, then encodes them
+	CompactFunction encode(L2Function &function);
+}
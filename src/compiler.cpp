@@ -4,6 +4,11 @@
 #include "register_allocator.h"
 #include "spiller.h"
 #include "code_gen.h"
+#include "serializer.h"
+#include "server.h"
+#include "disk_cache.h"
+#include "module.h"
+#include "arena.h"
 #include <string>
 #include <vector>
 #include <utility>
@@ -16,16 +21,118 @@
 #include <cstdlib>
 #include <stdint.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <iostream>
+#include <fstream>
 #include <assert.h>
 #include <optional>
+#include <thread>
+#include <atomic>
 
 void print_help(char *progName) {
-	std::cerr << "Usage: " << progName << " [-v] [-g 0|1] [-O 0|1|2] [-s] [-l] [-i] [-p] SOURCE" << std::endl;
+	std::cerr << "Usage: " << progName << " [--cache-dir DIR] [-v] [-g 0|1] [-O 0|1|2] [-s] [-l] [-i] [-p] [-j NUM_THREADS] [-L] [-F] [--reachable-only] [-w L2B_OUTPUT] [--huge-pages] SOURCE" << std::endl;
+	std::cerr << "       " << progName << " --module [--cache-dir DIR] SOURCE" << std::endl;
+	std::cerr << "       " << progName << " --link ENTRY_FUNCTION FRAGMENT..." << std::endl;
+	std::cerr << "       " << progName << " --batch LIST_FILE [--module] [-j NUM_THREADS] [-L] [--reachable-only]" << std::endl;
+	std::cerr << "       " << progName << " --server SOCKET_PATH [-j NUM_THREADS] [--cache-dir DIR]" << std::endl;
 	return;
 }
 
-int main(
+// Names the output after the input by replacing its extension, if any.
+std::string get_output_file_name(const std::string &input_file_name, const std::string &extension) {
+	std::size_t dot = input_file_name.find_last_of('.');
+	std::size_t slash = input_file_name.find_last_of('/');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+		return input_file_name + extension;
+	}
+	return input_file_name.substr(0, dot) + extension;
+}
+
+// Compiles a module (see module.h) into a fragment named after it.
+void compile_module_file(char *fileName, L2::code_gen::FunctionCodeCache *cache) {
+	L2::module::Fragment fragment = L2::module::compile_module(fileName, cache);
+	std::ofstream o(get_output_file_name(fileName, ".L1m"));
+	L2::module::write_fragment(fragment, o);
+}
+
+// Compiles every file listed (one per line) in the given file, spreading
+// them across num_threads workers. Each input is either L2 source or a
+// serialized program. Returns nonzero if any file failed to compile.
+int compile_batch(
+	const std::string &list_file_name,
+	int num_threads,
+	bool lazy,
+	bool reachable_only,
+	bool modules,
+	L2::code_gen::FunctionCodeCache *cache
+) {
+	std::ifstream list_file(list_file_name);
+	if (!list_file.is_open()) {
+		std::cerr << "Error: could not open " << list_file_name << std::endl;
+		return 1;
+	}
+	std::vector<std::string> file_names;
+	for (std::string line; std::getline(list_file, line);) {
+		if (!line.empty()) {
+			file_names.push_back(line);
+		}
+	}
+
+	std::vector<std::optional<std::string>> errors(file_names.size());
+	std::atomic<std::size_t> next_index = 0;
+	auto worker = [&]() {
+		for (std::size_t i = next_index++; i < file_names.size(); i = next_index++) {
+			std::string &file_name = file_names[i];
+			try {
+				if (modules) {
+					compile_module_file(file_name.data(), cache);
+					continue;
+				}
+				std::unique_ptr<L2::program::Program> p;
+				if (L2::serializer::is_serialized_program(file_name.c_str())) {
+					p = L2::serializer::load_program(file_name.c_str());
+				} else {
+					p = L2::parser::parse_file(file_name.data(), {}, 1, lazy);
+				}
+				std::ofstream o(get_output_file_name(file_name, ".L1"));
+				L2::code_gen::generate_code(*p, o, reachable_only, cache);
+			} catch (const std::exception &e) {
+				// includes I/O errors, so that one bad file does not stop
+				// the batch
+				errors[i] = std::string(e.what());
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (std::size_t i = 1; i < std::min<std::size_t>(num_threads, file_names.size()); ++i) {
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+
+	int result = 0;
+	for (std::size_t i = 0; i < file_names.size(); ++i) {
+		if (errors[i]) {
+			std::cerr << file_names[i] << ": Error: " << *errors[i] << std::endl;
+			result = 1;
+		}
+	}
+	return result;
+}
+
+// Parses the given L2 source, or loads it directly if it is already a
+// serialized program.
+std::unique_ptr<L2::program::Program> load_function_file(char *fileName) {
+	if (L2::serializer::is_serialized_program(fileName)) {
+		return L2::serializer::load_program(fileName);
+	}
+	return L2::parser::parse_function_file(fileName);
+}
+
+int run_compiler(
 	int argc,
 	char **argv
 ) {
@@ -34,6 +141,14 @@ int main(
 	bool interference_only = false;
 	bool liveness_only = false;
 	std::optional<std::string> parse_tree_output;
+	std::optional<std::string> serialized_output;
+	int num_threads = 1;
+	bool num_threads_given = false;
+	bool lazy = false;
+	// leaves out the functions that the entry function can't reach; with
+	// -L, their bodies are never parsed
+	bool reachable_only = false;
+	bool streaming = false;
 	int32_t optLevel = 3;
 
 	/*
@@ -44,10 +159,46 @@ int main(
 		print_help(argv[0]);
 		return 1;
 	}
+	std::optional<std::string> batch_list;
+	std::optional<std::string> server_socket;
+	std::optional<std::string> cache_dir;
+	std::optional<std::string> link_entry;
+	bool modules = false;
+	static const struct option long_options[] = {
+		{"batch", required_argument, nullptr, 'b'},
+		{"server", required_argument, nullptr, 'S'},
+		{"cache-dir", required_argument, nullptr, 'C'},
+		{"module", no_argument, nullptr, 'M'},
+		{"link", required_argument, nullptr, 'K'},
+		{"huge-pages", no_argument, nullptr, 'H'},
+		{"reachable-only", no_argument, nullptr, 'R'},
+		{nullptr, 0, nullptr, 0}
+	};
 	int32_t opt;
 	int64_t functionNumber = -1;
-	while ((opt = getopt(argc, argv, "vg:O:slip:")) != -1) {
+	while ((opt = getopt_long(argc, argv, "vg:O:slip:j:LFw:", long_options, nullptr)) != -1) {
 		switch (opt) {
+			case 'b':
+				batch_list = std::string(optarg);
+				break;
+			case 'S':
+				server_socket = std::string(optarg);
+				break;
+			case 'C':
+				cache_dir = std::string(optarg);
+				break;
+			case 'M':
+				modules = true;
+				break;
+			case 'K':
+				link_entry = std::string(optarg);
+				break;
+			case 'H':
+				L2::arena::set_huge_pages(true);
+				break;
+			case 'R':
+				reachable_only = true;
+				break;
 			case 'l':
 				liveness_only = true;
 				break;
@@ -69,12 +220,59 @@ int main(
 			case 'p':
 				parse_tree_output = std::string(optarg);
 				break;
+			case 'j':
+				num_threads = strtoul(optarg, NULL, 0);
+				num_threads_given = true;
+				break;
+			case 'L':
+				lazy = true;
+				break;
+			case 'F':
+				// one function at a time; needs the bodies to be parsed lazily
+				streaming = true;
+				lazy = true;
+				break;
+			case 'w':
+				serialized_output = std::string(optarg);
+				break;
 			default:
 				print_help(argv[0]);
 				return 1;
 		}
 	}
 
+	// opt-in cache of allocated functions, shared by every mode that
+	// generates code
+	std::optional<L2::code_gen::DiskFunctionCodeCache> disk_cache;
+	L2::code_gen::FunctionCodeCache *cache = nullptr;
+	if (cache_dir) {
+		disk_cache.emplace(*cache_dir, "O" + std::to_string(optLevel));
+		cache = &*disk_cache;
+	}
+
+	if (server_socket) {
+		// without -j, one worker per core
+		int num_workers = num_threads_given ? num_threads : std::thread::hardware_concurrency();
+		return L2::server::run_server(*server_socket, 4096, std::max(num_workers, 1), cache);
+	}
+	if (batch_list) {
+		// in batch mode, -j spreads files (not functions) across threads
+		return compile_batch(*batch_list, num_threads, lazy, reachable_only, modules, cache);
+	}
+	if (modules) {
+		compile_module_file(argv[optind], cache);
+		return 0;
+	}
+	if (link_entry) {
+		std::vector<L2::module::Fragment> fragments;
+		for (int i = optind; i < argc; ++i) {
+			fragments.push_back(L2::module::read_fragment(argv[i]));
+		}
+		std::ofstream o("prog.L1");
+		L2::module::link(fragments, *link_entry, o);
+		return 0;
+	}
+
 	/*
 	 * Parse the input file.
 	 */
@@ -91,7 +289,7 @@ int main(
 		return 0;
 	} else if (liveness_only) {
 		// Parse an L2 function.
-		p = L2::parser::parse_function_file(argv[optind]);
+		p = load_function_file(argv[optind]);
 
 		// Analyze results
 		L2::program::L2Function *f = p->get_l2_function(0);
@@ -103,7 +301,7 @@ int main(
 		return 0;
 	} else if (interference_only){
 		// Parse an L2 function.
-		p = L2::parser::parse_function_file(argv[optind]);
+		p = load_function_file(argv[optind]);
 		L2::program::L2Function *f = p->get_l2_function(0);
 		L2::program::analyze::InstructionsAnalysisResult liveness_results
 			= L2::program::analyze::analyze_instructions(*f);
@@ -120,12 +318,15 @@ int main(
 		return 0;
 	} else {
 		// Parse the L2 program.
-		p = L2::parser::parse_file(argv[optind], parse_tree_output);
-		auto mp = L2::program::analyze::allocate_and_spill_with_backup(*p->get_l2_function(0));
-		// std::cout << p->to_string();
-		// for (const auto [key, value] : mp) {
-		// 	std::cout << key->to_string() << ": " << value->to_string() << "\n";
-		// }
+		if (L2::serializer::is_serialized_program(argv[optind])) {
+			p = L2::serializer::load_program(argv[optind]);
+		} else {
+			p = L2::parser::parse_file(argv[optind], parse_tree_output, num_threads, lazy);
+		}
+		if (serialized_output) {
+			L2::serializer::write_program(*p, *serialized_output);
+			return 0;
+		}
 	}
 
 	// /*
@@ -158,8 +359,25 @@ int main(
 	//  */
 
 	if (enable_code_generator) {
-		L2::code_gen::generate_code(*p);
+		if (streaming) {
+			L2::code_gen::generate_code_streaming(*p, cache);
+		} else {
+			L2::code_gen::generate_code(*p, reachable_only, cache);
+		}
 	}
 
 	return 0;
 }
+
+int main(
+	int argc,
+	char **argv
+) {
+	try {
+		return run_compiler(argc, argv);
+	} catch (const std::exception &e) {
+		// also I/O and allocation failures, which get the same treatment
+		std::cerr << "Error: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,72 @@
+#include "disk_cache.h"
+#include "utils.h"
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace L2::code_gen {
+	// Change whenever the generated code changes for the same input, so that
+	// stale entries are never used.
+	static const char *const compiler_version = "l2c-1";
+
+	DiskFunctionCodeCache::DiskFunctionCodeCache(std::string directory, std::string options) :
+		directory {std::move(directory)},
+		options {std::move(options)}
+	{
+		mkdir(this->directory.c_str(), 0777); // fine if it already exists
+	}
+
+	std::string DiskFunctionCodeCache::get_entry_path(const std::string &key) const {
+		uint64_t hash = utils::fnv1a_64(compiler_version);
+		hash = utils::fnv1a_64(std::string_view("\0", 1), hash);
+		hash = utils::fnv1a_64(this->options, hash);
+		hash = utils::fnv1a_64(std::string_view("\0", 1), hash);
+		hash = utils::fnv1a_64(key, hash);
+		char name[17];
+		std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+		return this->directory + "/" + name;
+	}
+
+	// An entry holds the length of the key, the key itself (to detect hash
+	// collisions), and then the code.
+	std::optional<std::string> DiskFunctionCodeCache::get(const std::string &key) {
+		std::ifstream entry(this->get_entry_path(key), std::ios::binary);
+		if (!entry.is_open()) {
+			return {};
+		}
+		std::size_t key_size;
+		if (!(entry >> key_size) || entry.get() != '\n' || key_size != key.size()) {
+			return {};
+		}
+		std::string stored_key(key_size, '\0');
+		if (!entry.read(stored_key.data(), key_size) || stored_key != key) {
+			return {};
+		}
+		return std::string(std::istreambuf_iterator<char>(entry), std::istreambuf_iterator<char>());
+	}
+
+	void DiskFunctionCodeCache::put(const std::string &key, const std::string &code) {
+		std::string path = this->get_entry_path(key);
+		std::ostringstream temp_path;
+		temp_path << path << ".tmp." << getpid() << "." << std::this_thread::get_id();
+		{
+			std::ofstream entry(temp_path.str(), std::ios::binary);
+			if (!entry.is_open()) {
+				return; // the cache is only an optimization
+			}
+			entry << key.size() << "\n" << key << code;
+			if (!entry) {
+				entry.close();
+				std::remove(temp_path.str().c_str());
+				return;
+			}
+		}
+		if (std::rename(temp_path.str().c_str(), path.c_str()) != 0) {
+			std::remove(temp_path.str().c_str());
+		}
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "code_gen.h"
+#include <optional>
+#include <string>
+
+namespace L2::code_gen {
+	// Keeps the L1 code of functions in a directory, one file per function,
+	// named by a hash of the function's L2 text, the compiler version, and
+	// the options that affect code generation. Safe to share between threads
+	// and processes: entries are written to a temporary file and renamed
+	// into place.
+	class DiskFunctionCodeCache : public FunctionCodeCache {
+		private:
+
+		std::string directory;
+		std::string options;
+
+		public:
+
+		// options describes any compiler settings that change the generated
+		// code, so that entries made under other settings are not used
+		DiskFunctionCodeCache(std::string directory, std::string options);
+
+		virtual std::optional<std::string> get(const std::string &key) override;
+		virtual void put(const std::string &key, const std::string &code) override;
+
+		private:
+
+		std::string get_entry_path(const std::string &key) const;
+	};
+}
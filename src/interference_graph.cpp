@@ -10,48 +10,31 @@ namespace L2::program::analyze {
 	}
 
 	// SIRR: shift instruction register restrictions
-	class SirrInstVisitor : public InstructionVisitor {
-		private:
-
-		VariableGraph &target; // the graph to which the restrictions will be added
-		utils::set<const Register *> non_rcx_registers;
-
-		public:
-
-		SirrInstVisitor(VariableGraph &target, utils::set<const Register *> non_rsp_registers) :
-			target {target}, non_rcx_registers(non_rsp_registers.begin(), non_rsp_registers.end())
+	// Only rcx can be used as a shift argument, so a variable used as one
+	// conflicts with every other register.
+	void add_sirr_edges(
+		VariableGraph &graph,
+		const compact::CompactFunction &compact_function,
+		const compact::CompactInstruction &inst,
+		const std::vector<const Register *> &register_color_table
+	) {
+		if (inst.opcode != compact::Opcode::assign
+			|| (inst.assign_op != AssignOperator::lshift && inst.assign_op != AssignOperator::rshift))
 		{
-			for (auto it = this->non_rcx_registers.begin(); it != this->non_rcx_registers.end(); ++it) {
-				if ((*it)->name == "rcx") {
-					this->non_rcx_registers.erase(it);
-					break;
-				}
-			}
+			return;
 		}
-
-		virtual void visit(InstructionReturn &inst) {}
-		virtual void visit(InstructionCompareAssignment &inst) {}
-		virtual void visit(InstructionCompareJump &inst) {}
-		virtual void visit(InstructionLabel &inst) {}
-		virtual void visit(InstructionGoto &inst) {}
-		virtual void visit(InstructionCall &inst) {}
-		virtual void visit(InstructionLeaq &inst) {}
-		virtual void visit(InstructionAssignment &inst) {
-			if (inst.op == AssignOperator::lshift || inst.op == AssignOperator::rshift) {
-				for (VariableGraph::Node read_var : inst.source->get_vars_on_read()) {
-					for (VariableGraph::Node reg : this->non_rcx_registers) {
-						this->target.add_edge(read_var, reg);
-					}
-				}
-
-				// If only C++ let you pass a set<subtype> as a set<supertype>...
-				// this->target.add_total_bipartite(
-				// 	inst.source->get_vars_on_read();,
-				// 	this->non_rcx_registers
-				// );
+		const compact::Operand &source = inst.operands[1];
+		bool reads_var = source.kind == compact::OperandKind::variable || source.kind == compact::OperandKind::memory;
+		if (!reads_var || source.id == compact::no_variable) {
+			return;
+		}
+		VariableGraph::Node read_var = compact_function.variables[source.id];
+		for (const Register *reg : register_color_table) {
+			if (reg->id != registers::shift_amount) {
+				graph.add_edge(read_var, reg);
 			}
 		}
-	};
+	}
 
 	void pre_color_registers(VariableGraph &graph, const std::vector<const Register *> &register_color_table) {
 		for (VariableGraph::Color color = 0; color < register_color_table.size(); ++color) {
@@ -64,30 +47,40 @@ namespace L2::program::analyze {
 		const InstructionsAnalysisResult &inst_analysis,
 		const std::vector<const Register *> &register_color_table
 	) {
-		// TODO this will probably be more than necessary until we delete
-		// spilled variables from the scope
-		std::vector<VariableGraph::Node> total_vars = static_cast<const L2Function &>(l2_function).agg_scope.variable_scope.get_all_items();
+		return generate_interference_graph(l2_function, compact::encode(l2_function), inst_analysis, register_color_table);
+	}
+
+	VariableGraph generate_interference_graph(
+		const L2Function &l2_function,
+		const compact::CompactFunction &compact_function,
+		const InstructionsAnalysisResult &inst_analysis,
+		const std::vector<const Register *> &register_color_table
+	) {
+		// only the Variables still referred to, so that spilled ones don't
+		// pile up in the graph
+		std::vector<VariableGraph::Node> total_vars(
+			compact_function.variables.begin(),
+			compact_function.variables.begin() + compact_function.num_variables
+		);
 		total_vars.insert(total_vars.end(), register_color_table.begin(), register_color_table.end());
-		utils::set<const Register *> non_rsp_registers(register_color_table.begin(), register_color_table.end());
+		VariableSet non_rsp_registers(register_color_table.begin(), register_color_table.end());
 
 		VariableGraph result(total_vars);
-		result.add_total_bipartite(
-			(utils::set<VariableGraph::Node> &)non_rsp_registers, // I'm so sure these casts are safe... it's a set<derived> being passed into a CONST REF to set<base> ffs
-			(utils::set<VariableGraph::Node> &)non_rsp_registers
-		);
+		result.add_total_bipartite(non_rsp_registers, non_rsp_registers);
 		pre_color_registers(result, register_color_table);
 
-		SirrInstVisitor sirr_inst_visitor(result, non_rsp_registers);
+		for (std::size_t i = 0; i < inst_analysis.size(); ++i) {
+			const InstructionAnalysisResult &inst_analysis_result = inst_analysis[i];
 
-		for (const auto &[inst_ptr, inst_analysis_result] : inst_analysis) {
 			// add the in_set of this instruction to the graph
 			result.add_clique(inst_analysis_result.in_set);
 
-			// if this instruction has multiple successors, then also add the
-			// out_set of this instruction, since the in_sets of the
-			// succeeding instructions would not be enough to capture
-			// all the conflicts
-			if (inst_analysis_result.successors.size() > 1) {
+			// if this instruction has multiple successors (a cjump that is
+			// not last), then also add the out_set of this instruction, since
+			// the in_sets of the succeeding instructions would not be enough
+			// to capture all the conflicts
+			const compact::CompactInstruction &inst = compact_function.instructions[i];
+			if (inst.opcode == compact::Opcode::cjump && i + 1 < inst_analysis.size()) {
 				result.add_clique(inst_analysis_result.out_set);
 			}
 
@@ -95,7 +88,7 @@ namespace L2::program::analyze {
 			result.add_total_bipartite(inst_analysis_result.out_set, inst_analysis_result.kill_set);
 
 			// account for the special case where only rcx can be used as a shift argument
-			inst_ptr->accept(sirr_inst_visitor);
+			add_sirr_edges(result, compact_function, inst, register_color_table);
 		}
 		return result;
 	}
@@ -106,8 +99,9 @@ namespace L2::program::analyze {
 		// contains the Variable * with the highest degree overall
 		std::pair<VariableGraph::Node, int> most_overall = std::make_pair(nullptr, 0);
 
-		for (const auto &[node, i] : graph.get_node_map()) {
+		for (std::size_t i = 0; i < graph.size(); ++i) {
 			const VariableGraph::NodeInfo &node_info = graph.get_node_info(i);
+			VariableGraph::Node node = node_info.node;
 			if (!node_info.is_enabled || node_info.color) {
 				continue;
 			}
@@ -134,7 +128,7 @@ namespace L2::program::analyze {
 
 	std::optional<VariableGraph::Color> determine_replacement_color(VariableGraph &graph, int num_colors, VariableGraph::Node var) {
 		// std::cerr << "finding replacement color for " << var->to_string() << "\n";
-		std::vector<bool> color_allowed(num_colors, true);
+		arena::ScratchVector<bool> color_allowed(num_colors, true);
 		for (std::size_t neighbor_idx : graph.get_node_info(var).adj_vec) {
 			const VariableGraph::NodeInfo &neighbor_info = graph.get_node_info(neighbor_idx);
 			// std::cerr << "neighbor " << neighbor_info.node->to_string();
@@ -159,7 +153,7 @@ namespace L2::program::analyze {
 		const std::vector<const Register *> &register_color_table
 	) {
 		std::vector<VariableGraph::Node> spilled;
-		std::stack<VariableGraph::Node> removed_vars;
+		std::stack<VariableGraph::Node, arena::ScratchVector<VariableGraph::Node>> removed_vars;
 
 		std::optional<VariableGraph::Node> to_remove;
 		while (to_remove = determine_variable_to_remove(graph, register_color_table.size())) {
@@ -3,7 +3,6 @@
 #include "liveness.h"
 #include "utils.h"
 #include <assert.h>
-#include <map>
 #include <vector>
 #include <tuple>
 #include <algorithm>
@@ -12,6 +11,8 @@
 namespace L2::program::analyze {
 
 	// Prevents self-edges; attempts to create them will be ignored.
+	// N must be a pointer to something with a dense `index` (such as a
+	// numbered Variable), which is used to find its node.
 	template<typename N>
 	class ColoringGraph {
 		public:
@@ -21,7 +22,7 @@ namespace L2::program::analyze {
 		using Color = int;
 		struct NodeInfo {
 			Node node;
-			std::vector<std::size_t> adj_vec; // includes disabled nodes
+			arena::ScratchVector<std::size_t> adj_vec; // includes disabled nodes
 			std::optional<Color> color;
 			int degree = 0; // only counts enabled nodes
 			bool is_enabled = true;
@@ -29,25 +30,31 @@ namespace L2::program::analyze {
 
 		private:
 
-		std::map<Node, std::size_t> node_map;
-		std::vector<NodeInfo> data;
+		static constexpr std::size_t no_node = static_cast<std::size_t>(-1);
+
+		// maps Node::index to the node's position in this->data
+		arena::ScratchVector<std::size_t> node_map;
+		arena::ScratchVector<NodeInfo> data;
 
 		public:
 
 		ColoringGraph(const std::vector<Node> &nodes) : node_map {}, data {} {
 			this->data.resize(nodes.size());
 			for (std::size_t i = 0; i < nodes.size(); ++i) {
-				this->node_map.insert(std::make_pair(nodes[i], i));
+				if (nodes[i]->index >= this->node_map.size()) {
+					this->node_map.resize(nodes[i]->index + 1, no_node);
+				}
+				this->node_map[nodes[i]->index] = i;
 				this->data[i].node = nodes[i];
 			}
 		}
 
-		const std::map<Node, std::size_t> &get_node_map() const {
-			return this->node_map;
+		std::size_t size() const {
+			return this->data.size();
 		}
 
 		const NodeInfo &get_node_info(Node node) const {
-			std::size_t u = this->node_map.at(node);
+			std::size_t u = this->get_position(node);
 			return this->get_node_info(u);
 		}
 		const NodeInfo &get_node_info(std::size_t u) const {
@@ -57,8 +64,8 @@ namespace L2::program::analyze {
 		// Checks whether two nodes conflict. Both must be enabled for them to
 		// conflict.
 		bool check_color_conflict(Node node_a, Node node_b) const {
-			std::size_t u = this->node_map.at(node_a);
-			std::size_t v = this->node_map.at(node_b);
+			std::size_t u = this->get_position(node_a);
+			std::size_t v = this->get_position(node_b);
 			return this->check_color_conflict(u, v);
 		}
 		bool check_color_conflict(std::size_t u, std::size_t v) const {
@@ -71,7 +78,7 @@ namespace L2::program::analyze {
 
 		// Checks whether a node conflicts with any of its enabled neighbors.
 		bool check_color_conflict(Node node) const {
-			std::size_t u = this->node_map.at(node);
+			std::size_t u = this->get_position(node);
 			return this->check_color_conflict(u);
 		}
 		bool check_color_conflict(std::size_t u) const {
@@ -88,8 +95,8 @@ namespace L2::program::analyze {
 		}
 
 		void add_edge(Node node_a, Node node_b) {
-			std::size_t u = this->node_map.at(node_a);
-			std::size_t v = this->node_map.at(node_b);
+			std::size_t u = this->get_position(node_a);
+			std::size_t v = this->get_position(node_b);
 			return this->add_edge(u, v);
 		}
 		void add_edge(std::size_t u, std::size_t v) {
@@ -97,8 +104,7 @@ namespace L2::program::analyze {
 				return;
 			}
 			if (this->check_color_conflict(u, v)) {
-				std::cerr << "Cannot add an edge between two nodes of the same color\n";
-				exit(1);
+				throw CompileError("Cannot add an edge between two nodes of the same color");
 			}
 
 			NodeInfo &u_info = this->data[u];
@@ -129,7 +135,9 @@ namespace L2::program::analyze {
 			}
 		}
 
-		void add_clique(const utils::set<Node> &nodes) {
+		// Set is any set of Nodes, such as a utils::FlatSet
+		template<typename Set>
+		void add_clique(const Set &nodes) {
 			for (auto it_a = nodes.begin(); it_a != nodes.end(); ++it_a) {
 				auto it_b = it_a;
 				++it_b;
@@ -141,7 +149,8 @@ namespace L2::program::analyze {
 
 		// adds all possible edges between a node in group_a and a node in group_b
 		// avoids adding self-edges
-		void add_total_bipartite(const utils::set<Node> &group_a, const utils::set<Node> &group_b) {
+		template<typename Set>
+		void add_total_bipartite(const Set &group_a, const Set &group_b) {
 			for (Node node_a : group_a) {
 				for (Node node_b : group_b) {
 					if (node_a != node_b) {
@@ -160,7 +169,7 @@ namespace L2::program::analyze {
 		// }
 
 		void disable_node(Node node) {
-			std::size_t u = this->node_map.at(node);
+			std::size_t u = this->get_position(node);
 			if (!this->data[u].is_enabled) {
 				return;
 			}
@@ -174,14 +183,13 @@ namespace L2::program::analyze {
 		// Enables a node with the specified color.
 		// Will error if there are any color conflicts.
 		void attempt_enable_with_color(Node node, std::optional<Color> color) {
-			std::size_t u = this->node_map.at(node);
+			std::size_t u = this->get_position(node);
 			NodeInfo &node_info = this->data[u];
 			bool prev_enabled = node_info.is_enabled;
 			node_info.color = color;
 			node_info.is_enabled = true;
 			if (this->check_color_conflict(u)) {
-				std::cerr << "Error: attempted to give a node a color that conflicts.\n";
-				exit(1);
+				throw CompileError("attempted to give a node a color that conflicts");
 			}
 			if (!prev_enabled) {
 				for (std::size_t neighbor_idx : node_info.adj_vec) {
@@ -193,20 +201,11 @@ namespace L2::program::analyze {
 		void verify_no_conflicts() const {
 			for (std::size_t i = 0; i < this->data.size(); ++i) {
 				if (this->check_color_conflict(i)) {
-					std::cerr << "Error: color conflict\n";
-					exit(1);
+					throw CompileError("color conflict");
 				}
 			}
 		}
 
-		// assumes that every node is colored
-		std::map<Node, Color> get_coloring() const {
-			std::map<Node, Color> result;
-			for (const NodeInfo &node_info : this->data) {
-				result.insert(std::make_pair(node_info.node, *node_info.color));
-			}
-			return result;
-		}
 
 		std::string to_string() const {
 			std::string result;
@@ -231,15 +230,33 @@ namespace L2::program::analyze {
 			}
 			return result;
 		}
+
+		private:
+
+		std::size_t get_position(Node node) const {
+			if (node->index >= this->node_map.size() || this->node_map[node->index] == no_node) {
+				throw CompileError("node is not in the graph: " + node->to_string());
+			}
+			return this->node_map[node->index];
+		}
 	};
 
 	using VariableGraph = ColoringGraph<const Variable *>;
 
+	// inst_analysis must come from analyze_instructions on the same function,
+	// so that its variables are numbered
 	VariableGraph generate_interference_graph(
 		L2Function &l2_function,
 		const InstructionsAnalysisResult &inst_analysis,
 		const std::vector<const Register *> &register_color_table
 	);
+	// inst_analysis must come from the same encoding of the function
+	VariableGraph generate_interference_graph(
+		const L2Function &l2_function,
+		const compact::CompactFunction &compact_function,
+		const InstructionsAnalysisResult &inst_analysis,
+		const std::vector<const Register *> &register_color_table
+	);
 
 	// Given a GoloringGraph, tries to color it with the colors 0..num_colors.
 	// Pre-colored nodes are allowed.
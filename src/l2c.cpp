@@ -0,0 +1,26 @@
+#include "l2c.h"
+#include "parser.h"
+#include "code_gen.h"
+#include "program.h"
+#include <sstream>
+
+namespace L2 {
+	CompileResult compile(
+		std::string_view source,
+		const std::string &source_name,
+		code_gen::FunctionCodeCache *cache
+	) {
+		CompileResult result;
+		try {
+			std::unique_ptr<program::Program> p = parser::parse_program(source, source_name);
+			std::ostringstream o;
+			code_gen::generate_code(*p, o, false, cache);
+			result.l1 = o.str();
+		} catch (const std::exception &e) {
+			// not only CompileErrors: I/O and allocation failures (and any
+			// internal error) must not escape to the host either
+			result.diagnostics.push_back(e.what());
+		}
+		return result;
+	}
+}
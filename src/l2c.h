@@ -0,0 +1,30 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace L2::code_gen {
+	class FunctionCodeCache;
+}
+
+// The compiler as a library (libl2c), for clients that compile many
+// programs in one process. compile() never exits the process and keeps no
+// state between calls, so it may be called repeatedly and concurrently.
+namespace L2 {
+	struct CompileResult {
+		std::optional<std::string> l1; // the L1 program; empty if compilation failed
+		std::vector<std::string> diagnostics;
+
+		bool succeeded() const { return this->l1.has_value(); }
+	};
+
+	// If a cache is given, functions found in it are not compiled again; the
+	// cache must be safe to use from every thread that calls compile.
+	CompileResult compile(
+		std::string_view source,
+		const std::string &source_name = "<source>",
+		code_gen::FunctionCodeCache *cache = nullptr
+	);
+}
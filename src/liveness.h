@@ -1,22 +1,29 @@
 #pragma once
 #include "program.h"
+#include "compact_ir.h"
 #include "utils.h"
 #include <vector>
-#include <map>
 #include <set>
 
 namespace L2::program::analyze {
+	// Allocated from the current arena::Scratch, as are the other containers
+	// of the analyses.
+	using VariableSet = utils::FlatSet<const Variable *, 8, std::less<void>, arena::ScratchAllocator<const Variable *>>;
+
 	struct InstructionAnalysisResult {
-		std::vector<Instruction *> successors;
-		utils::set<const Variable *> gen_set;
-		utils::set<const Variable *> kill_set;
-		utils::set<const Variable *> in_set;
-		utils::set<const Variable *> out_set;
+		VariableSet gen_set;
+		VariableSet kill_set;
+		VariableSet in_set;
+		VariableSet out_set;
 	};
 
-	using InstructionsAnalysisResult = std::map<Instruction *, InstructionAnalysisResult>;
+	// indexed by Instruction::ordinal
+	using InstructionsAnalysisResult = arena::ScratchVector<InstructionAnalysisResult>;
 
-	InstructionsAnalysisResult analyze_instructions(const L2Function &function);
+	// numbers the function's instructions and variables before analyzing it
+	InstructionsAnalysisResult analyze_instructions(L2Function &function);
+	// analyzes an encoding of the function
+	InstructionsAnalysisResult analyze_instructions(const L2Function &function, const compact::CompactFunction &compact_function);
 
-	void print_liveness(const L2Function &function, InstructionsAnalysisResult &liveness_results);
+	void print_liveness(const L2Function &function, const InstructionsAnalysisResult &liveness_results);
 }
@@ -0,0 +1,149 @@
+#include "module.h"
+#include "parser.h"
+#include "program.h"
+#include <fstream>
+#include <map>
+#include <sstream>
+
+namespace L2::module {
+	using namespace L2::program;
+
+	// records how many arguments each free function is called with
+	class ImportArityVisitor : public InstructionVisitor {
+		private:
+		std::map<std::string_view, int64_t> &arities;
+
+		public:
+
+		ImportArityVisitor(std::map<std::string_view, int64_t> &arities) : arities {arities} {}
+
+		virtual void visit(InstructionReturn &inst) override {}
+		virtual void visit(InstructionAssignment &inst) override {}
+		virtual void visit(InstructionCompareAssignment &inst) override {}
+		virtual void visit(InstructionCompareJump &inst) override {}
+		virtual void visit(InstructionLabel &inst) override {}
+		virtual void visit(InstructionGoto &inst) override {}
+		virtual void visit(InstructionCall &inst) override {
+			L2FunctionRef *callee = dynamic_cast<L2FunctionRef *>(inst.callee.get());
+			if (!callee) {
+				return;
+			}
+			auto it = this->arities.find(callee->get_ref_name());
+			if (it == this->arities.end()) {
+				return;
+			}
+			if (it->second != -1 && it->second != inst.num_arguments) {
+				throw CompileError(
+					"@" + std::string(it->first) + " is called with both "
+					+ std::to_string(it->second) + " and "
+					+ std::to_string(inst.num_arguments) + " arguments"
+				);
+			}
+			it->second = inst.num_arguments;
+		}
+		virtual void visit(InstructionLeaq &inst) override {}
+	};
+
+	Fragment compile_module(char *fileName, code_gen::FunctionCodeCache *cache) {
+		std::unique_ptr<Program> p = parser::parse_module_file(fileName);
+		return compile_module(*p, cache);
+	}
+
+	Fragment compile_module(Program &p, code_gen::FunctionCodeCache *cache) {
+		Fragment fragment;
+
+		// the names still free at the program level belong to other modules
+		std::map<std::string_view, int64_t> import_arities;
+		for (std::string_view name : p.get_scope().l2_function_scope.get_free_names()) {
+			import_arities.insert({name, -1});
+		}
+		ImportArityVisitor visitor(import_arities);
+		for (const std::unique_ptr<L2Function> &function : p.get_l2_functions()) {
+			fragment.exports.push_back({std::string(function->get_name()), function->get_num_arguments()});
+			for (const std::unique_ptr<Instruction> &inst : function->instructions) {
+				inst->accept(visitor);
+			}
+		}
+		for (const auto &[name, num_arguments] : import_arities) {
+			fragment.imports.push_back({std::string(name), num_arguments});
+		}
+
+		// placeholders let code generation print the imported names
+		p.bind_free_names();
+		std::ostringstream code;
+		for (std::size_t i = 0; i < p.get_l2_functions().size(); ++i) {
+			code_gen::generate_function_code(p, *p.get_l2_function(i), code, cache);
+		}
+		fragment.code = code.str();
+		return fragment;
+	}
+
+	void write_fragment(const Fragment &fragment, std::ostream &o) {
+		for (const FunctionSignature &signature : fragment.exports) {
+			o << "// export " << signature.name << " " << signature.num_arguments << "\n";
+		}
+		for (const FunctionSignature &signature : fragment.imports) {
+			o << "// import " << signature.name << " " << signature.num_arguments << "\n";
+		}
+		o << fragment.code;
+	}
+
+	Fragment read_fragment(const std::string &fileName) {
+		std::ifstream file(fileName);
+		if (!file.is_open()) {
+			throw CompileError("could not open " + fileName);
+		}
+		Fragment fragment;
+		std::string line;
+		while (file.peek() == '/' && std::getline(file, line)) {
+			std::istringstream header(line);
+			std::string comment, kind;
+			FunctionSignature signature;
+			if (!(header >> comment >> kind >> signature.name >> signature.num_arguments)
+				|| comment != "//"
+				|| (kind != "export" && kind != "import")
+			) {
+				throw CompileError(fileName + ": malformed module header: " + line);
+			}
+			(kind == "export" ? fragment.exports : fragment.imports).push_back(signature);
+		}
+		std::stringstream code;
+		code << file.rdbuf();
+		fragment.code = code.str();
+		return fragment;
+	}
+
+	void link(const std::vector<Fragment> &fragments, const std::string &entry_function_name, std::ostream &o) {
+		std::map<std::string, int64_t> exports;
+		for (const Fragment &fragment : fragments) {
+			for (const FunctionSignature &signature : fragment.exports) {
+				if (!exports.insert({signature.name, signature.num_arguments}).second) {
+					throw CompileError("@" + signature.name + " is defined by more than one module");
+				}
+			}
+		}
+		for (const Fragment &fragment : fragments) {
+			for (const FunctionSignature &signature : fragment.imports) {
+				auto it = exports.find(signature.name);
+				if (it == exports.end()) {
+					throw CompileError("@" + signature.name + " is not defined by any module");
+				}
+				if (signature.num_arguments != -1 && signature.num_arguments != it->second) {
+					throw CompileError(
+						"@" + signature.name + " takes " + std::to_string(it->second)
+						+ " arguments but is called with " + std::to_string(signature.num_arguments)
+					);
+				}
+			}
+		}
+		if (!exports.count(entry_function_name)) {
+			throw CompileError("the entry function @" + entry_function_name + " is not defined by any module");
+		}
+
+		o << "(@" << entry_function_name << "\n";
+		for (const Fragment &fragment : fragments) {
+			o << fragment.code;
+		}
+		o << ")\n";
+	}
+}
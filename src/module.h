@@ -0,0 +1,41 @@
+#pragma once
+
+#include "code_gen.h"
+#include "program.h"
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Separate compilation. A module is an L2 file holding only functions (no
+// enclosing parens or entry point) that may call functions of other
+// modules. Each module compiles on its own into an L1 fragment whose header
+// lists the functions it exports and imports:
+//   // export NAME NUM_ARGUMENTS
+//   // import NAME NUM_ARGUMENTS      (-1 if never called directly)
+// followed by the L1 code of its functions. Linking checks the fragments
+// against each other and stitches them into one L1 program.
+namespace L2::module {
+	struct FunctionSignature {
+		std::string name;
+		int64_t num_arguments;
+	};
+
+	struct Fragment {
+		std::vector<FunctionSignature> exports;
+		std::vector<FunctionSignature> imports;
+		std::string code;
+	};
+
+	Fragment compile_module(char *fileName, code_gen::FunctionCodeCache *cache = nullptr);
+	// the program must have been parsed as a module, with its free names
+	// not yet bound
+	Fragment compile_module(L2::program::Program &p, code_gen::FunctionCodeCache *cache = nullptr);
+	void write_fragment(const Fragment &fragment, std::ostream &o);
+	Fragment read_fragment(const std::string &fileName);
+
+	// Throws a CompileError if an import is not exported by exactly one
+	// module or is called with the wrong number of arguments, or if the
+	// entry function is not exported.
+	void link(const std::vector<Fragment> &fragments, const std::string &entry_function_name, std::ostream &o);
+}
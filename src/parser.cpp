@@ -2,12 +2,14 @@
 #include "program.h"
 #include "utils.h"
 #include <typeinfo>
+#include <type_traits>
 #include <sched.h>
 #include <string>
 #include <vector>
 #include <utility>
 #include <algorithm>
 #include <set>
+#include <unordered_map>
 #include <iterator>
 #include <cstring>
 #include <cctype>
@@ -15,6 +17,9 @@
 #include <stdint.h>
 #include <assert.h>
 #include <fstream>
+#include <thread>
+#include <atomic>
+#include <exception>
 #include <tao/pegtl.hpp>
 #include <tao/pegtl/contrib/analyze.hpp>
 #include <tao/pegtl/contrib/raw_string.hpp>
@@ -489,14 +494,32 @@ namespace L2::parser {
 			>
 		{};
 
-		struct FunctionRule :
+		// a FunctionRule up to its argument count; in lazy mode, the body is
+		// parsed separately once the function is needed
+		struct FunctionHeaderRule :
 			interleaved<
 				LineSeparatorsWithCommentsRule,
 				seq<SpacesRule, one<'('>>,
 				seq<SpacesRule, FunctionNameRule>,
-				seq<SpacesRule, ArgumentNumberRule>,
-				InstructionsRule,
-				seq<SpacesRule, one<')'>>
+				seq<SpacesRule, ArgumentNumberRule>
+			>
+		{};
+
+		struct FunctionBodyRule :
+			seq<
+				LineSeparatorsWithCommentsRule,
+				interleaved<
+					LineSeparatorsWithCommentsRule,
+					InstructionsRule,
+					seq<SpacesRule, one<')'>>
+				>
+			>
+		{};
+
+		struct FunctionRule :
+			seq<
+				FunctionHeaderRule,
+				FunctionBodyRule
 			>
 		{};
 
@@ -533,6 +556,32 @@ namespace L2::parser {
 
 		struct EntryPointRule :	must<ProgramRule> {};
 
+		// a module is the functions of a program without the program's parens
+		// and entry point; see module.h
+		struct ModuleRule :
+			seq<
+				LineSeparatorsWithCommentsRule,
+				FunctionsRule,
+				LineSeparatorsWithCommentsRule,
+				SpacesRule
+			>
+		{};
+
+		// everything in a ProgramRule before its first FunctionRule; used
+		// when the functions themselves are parsed separately
+		struct ProgramHeaderRule :
+			seq<
+				LineSeparatorsWithCommentsRule,
+				interleaved<
+					LineSeparatorsWithCommentsRule,
+					seq<SpacesRule, one<'('>>,
+					FunctionNameRule
+				>,
+				LineSeparatorsWithCommentsRule,
+				SpacesRule
+			>
+		{};
+
 		template<typename Rule>
 		struct Selector : pegtl::parse_tree::selector<
 			Rule,
@@ -657,67 +706,69 @@ namespace L2::parser {
 			return n.string_view();
 		}
 
-		ptr<LabelRef> make_label_ref(const ParseNode &n) {
+		ptr<LabelRef> make_label_ref(const ParseNode &n, SymbolTable &symbols) {
 			assert(*n.rule == typeid(rules::LabelRule));
-			return std::make_unique<LabelRef>(convert_name_rule(n[0]));
+			std::string_view name = convert_name_rule(n[0]);
+			return std::make_unique<LabelRef>(symbols.intern(name), name);
 		}
 
-		ptr<L2FunctionRef> make_l2_function_ref(const ParseNode &n) {
+		ptr<L2FunctionRef> make_l2_function_ref(const ParseNode &n, SymbolTable &symbols) {
 			assert(*n.rule == typeid(rules::FunctionNameRule));
-			return std::make_unique<L2FunctionRef>(convert_name_rule(n[0]));
+			std::string_view name = convert_name_rule(n[0]);
+			return std::make_unique<L2FunctionRef>(symbols.intern(name), name);
 		}
 
-		ptr<VariableRef> convert_variable_rule(const ParseNode &n) {
+		ptr<VariableRef> convert_variable_rule(const ParseNode &n, SymbolTable &symbols) {
 			assert(*n.rule == typeid(rules::VariableRule));
-			return std::make_unique<VariableRef>(convert_name_rule(n[0]));
+			std::string_view name = convert_name_rule(n[0]);
+			return std::make_unique<VariableRef>(symbols.intern(name), name);
 		}
 
-		ptr<RegisterRef> convert_register_rule(const ParseNode &n) {
+		ptr<RegisterRef> convert_register_rule(const ParseNode &n, SymbolTable &symbols) {
 			assert(*n.rule == typeid(rules::RegisterRule));
-			return std::make_unique<RegisterRef>(n.string_view());
+			return std::make_unique<RegisterRef>(symbols.intern(n.string_view()), n.string_view());
 		}
 
-		ptr<Expr> make_expr(const ParseNode &n);
+		ptr<Expr> make_expr(const ParseNode &n, SymbolTable &symbols);
 
 		ptr<StackArg> convert_stack_arg_rule(const ParseNode &n) {
 			assert(*n.rule == typeid(rules::StackArgRule));
 			return std::make_unique<StackArg>(convert_number_rule(n[0]));
 		}
 
-		ptr<MemoryLocation> convert_memory_location_rule(const ParseNode &n) {
+		ptr<MemoryLocation> convert_memory_location_rule(const ParseNode &n, SymbolTable &symbols) {
 			assert(*n.rule == typeid(rules::MemoryLocationRule));
 			return std::make_unique<MemoryLocation>(
-				make_expr(n[0]),
+				make_expr(n[0], symbols),
 				convert_number_rule(n[1])
 			);
 		}
 
-		ptr<ExternalFunctionRef> convert_std_function_name_rule(const ParseNode &n) {
+		ptr<ExternalFunctionRef> convert_std_function_name_rule(const ParseNode &n, SymbolTable &symbols) {
 			assert(*n.rule == typeid(rules::StdFunctionNameRule));
-			return std::make_unique<ExternalFunctionRef>(n.string_view());
+			return std::make_unique<ExternalFunctionRef>(symbols.intern(n.string_view()), n.string_view());
 		}
 
-		ptr<Expr> make_expr(const ParseNode &n) {
+		ptr<Expr> make_expr(const ParseNode &n, SymbolTable &symbols) {
 			const std::type_info &rule = *n.rule;
 			if (rule == typeid(rules::RegisterRule)) {
-				return convert_register_rule(n);
+				return convert_register_rule(n, symbols);
 			} else if (rule == typeid(rules::NumberRule)) {
 				return convert_number_rule(n);
 			} else if (rule == typeid(rules::LabelRule)) {
-				return make_label_ref(n);
+				return make_label_ref(n, symbols);
 			} else if (rule == typeid(rules::VariableRule)) {
-				return convert_variable_rule(n);
+				return convert_variable_rule(n, symbols);
 			} else if (rule == typeid(rules::FunctionNameRule)) {
-				return make_l2_function_ref(n);
+				return make_l2_function_ref(n, symbols);
 			} else if (rule == typeid(rules::StdFunctionNameRule)) {
-				return convert_std_function_name_rule(n);
+				return convert_std_function_name_rule(n, symbols);
 			} else if (rule == typeid(rules::MemoryLocationRule)) {
-				return convert_memory_location_rule(n);
+				return convert_memory_location_rule(n, symbols);
 			} else if (rule == typeid(rules::StackArgRule)) {
 				return convert_stack_arg_rule(n);
 			} else {
-				std::cerr << "Cannot make Expr from this parse node of type " << n.type << "\n";
-				exit(1);
+				throw CompileError("Cannot make Expr from this parse node of type " + std::string(n.type));
 			}
 		}
 
@@ -733,45 +784,45 @@ namespace L2::parser {
 			return str_to_cmp_op(n.string_view());
 		}
 
-		ptr<InstructionCompareAssignment> convert_instruction_assignment_compare(const ParseNode &n) {
+		ptr<InstructionCompareAssignment> convert_instruction_assignment_compare(const ParseNode &n, SymbolTable &symbols) {
 			assert(*n.rule == typeid(rules::InstructionAssignmentCompareRule));
 			return std::make_unique<InstructionCompareAssignment>(
-				make_expr(n[0]),
+				make_expr(n[0], symbols),
 				convert_comparison_operator_rule(n[2]),
-				make_expr(n[1]),
-				make_expr(n[3])
+				make_expr(n[1], symbols),
+				make_expr(n[3], symbols)
 			);
 		}
 
-		std::unique_ptr<InstructionAssignment> make_pure_instruction_assignment(const ParseNode &n) {
+		std::unique_ptr<InstructionAssignment> make_pure_instruction_assignment(const ParseNode &n, SymbolTable &symbols) {
 			assert(*n.rule == typeid(rules::InstructionAssignmentRule)
 				|| *n.rule == typeid(rules::InstructionMemoryReadRule)
 				|| *n.rule == typeid(rules::InstructionMemoryWriteRule)
 				|| *n.rule == typeid(rules::InstructionStackArgRule));
 			return std::make_unique<InstructionAssignment>(
 				AssignOperator::pure,
-				make_expr(n[1]),
-				make_expr(n[0])
+				make_expr(n[1], symbols),
+				make_expr(n[0], symbols)
 			);
 		}
 
-		std::unique_ptr<InstructionAssignment> make_plus_instruction_assignment(const ParseNode &n) {
+		std::unique_ptr<InstructionAssignment> make_plus_instruction_assignment(const ParseNode &n, SymbolTable &symbols) {
 			assert(*n.rule == typeid(rules::InstructionPlusReadMemoryRule)
 				|| *n.rule == typeid(rules::InstructionPlusWriteMemoryRule));
 			return std::make_unique<InstructionAssignment>(
 				AssignOperator::add,
-				make_expr(n[1]),
-				make_expr(n[0])
+				make_expr(n[1], symbols),
+				make_expr(n[0], symbols)
 			);
 		}
 
-		std::unique_ptr<InstructionAssignment> make_minus_instruction_assignment(const ParseNode &n) {
+		std::unique_ptr<InstructionAssignment> make_minus_instruction_assignment(const ParseNode &n, SymbolTable &symbols) {
 			assert(*n.rule == typeid(rules::InstructionMinusReadMemoryRule)
 				|| *n.rule == typeid(rules::InstructionMinusWriteMemoryRule));
 			return std::make_unique<InstructionAssignment>(
 				AssignOperator::subtract,
-				make_expr(n[1]),
-				make_expr(n[0])
+				make_expr(n[1], symbols),
+				make_expr(n[0], symbols)
 			);
 		}
 
@@ -780,136 +831,139 @@ namespace L2::parser {
 			return std::make_unique<InstructionReturn>();
 		}
 
-		std::unique_ptr<InstructionAssignment> make_custom_op_instruction_assignment(const ParseNode &n){
+		std::unique_ptr<InstructionAssignment> make_custom_op_instruction_assignment(const ParseNode &n, SymbolTable &symbols){
 			assert(*n.rule == typeid(rules::InstructionArithmeticOperationRule)
 				|| *n.rule == typeid(rules::InstructionShiftOperationRule));
 			return std::make_unique<InstructionAssignment>(
 				make_assign_operator(n[1]),
-				make_expr(n[2]),
-				make_expr(n[0])
+				make_expr(n[2], symbols),
+				make_expr(n[0], symbols)
 			);
 		}
 
-		ptr<InstructionCompareJump> convert_instruction_cjump_rule(const ParseNode &n) {
+		ptr<InstructionCompareJump> convert_instruction_cjump_rule(const ParseNode &n, SymbolTable &symbols) {
 			assert(*n.rule == typeid(rules::InstructionCJumpRule));
 			return std::make_unique<InstructionCompareJump>(
 				convert_comparison_operator_rule(n[1]),
-				make_expr(n[0]),
-				make_expr(n[2]),
-				make_label_ref(n[3])
+				make_expr(n[0], symbols),
+				make_expr(n[2], symbols),
+				make_label_ref(n[3], symbols)
 			);
 		}
 
-		ptr<InstructionLabel> convert_instruction_label_rule(const ParseNode &n) {
+		ptr<InstructionLabel> convert_instruction_label_rule(const ParseNode &n, SymbolTable &symbols) {
 			assert(*n.rule == typeid(rules::InstructionLabelRule));
-			return std::make_unique<InstructionLabel>(convert_name_rule(n[0][0]));
+			std::string_view name = convert_name_rule(n[0][0]);
+			return std::make_unique<InstructionLabel>(symbols.intern(name), name);
 		}
 
-		ptr<InstructionGoto> convert_instruction_goto_label_rule(const ParseNode &n) {
+		ptr<InstructionGoto> convert_instruction_goto_label_rule(const ParseNode &n, SymbolTable &symbols) {
 			assert(*n.rule == typeid(rules::InstructionGotoLabelRule));
-			return std::make_unique<InstructionGoto>(make_label_ref(n[0]));
+			return std::make_unique<InstructionGoto>(make_label_ref(n[0], symbols));
 		}
 
-		std::unique_ptr<InstructionCall> make_instruction_call(const ParseNode &n) {
+		std::unique_ptr<InstructionCall> make_instruction_call(const ParseNode &n, SymbolTable &symbols) {
 			assert(*n.rule == typeid(rules::InstructionFunctionCallRule)
 				|| *n.rule == typeid(rules::InstructionStdCallRule));
 			return std::make_unique<InstructionCall>(
-				make_expr(n[0]),
+				make_expr(n[0], symbols),
 				convert_number_rule(n[1])->value
 			);
 		}
 
-		std::unique_ptr<InstructionAssignment> convert_instruction_increment_rule(const ParseNode &n) {
+		std::unique_ptr<InstructionAssignment> convert_instruction_increment_rule(const ParseNode &n, SymbolTable &symbols) {
 			assert(*n.rule == typeid(rules::InstructionIncrementRule));
 			return std::make_unique<InstructionAssignment>(
 				AssignOperator::add,
 				std::make_unique<NumberLiteral>(1),
-				make_expr(n[0])
+				make_expr(n[0], symbols)
 			);
 		}
 
-		std::unique_ptr<InstructionAssignment> convert_instruction_decrement_rule(const ParseNode &n) {
+		std::unique_ptr<InstructionAssignment> convert_instruction_decrement_rule(const ParseNode &n, SymbolTable &symbols) {
 			assert(*n.rule == typeid(rules::InstructionDecrementRule));
 			return std::make_unique<InstructionAssignment>(
 				AssignOperator::subtract,
 				std::make_unique<NumberLiteral>(1),
-				make_expr(n[0])
+				make_expr(n[0], symbols)
 			);
 		}
 
-		std::unique_ptr<InstructionLeaq> convert_instruction_lea_rule(const ParseNode &n) {
+		std::unique_ptr<InstructionLeaq> convert_instruction_lea_rule(const ParseNode &n, SymbolTable &symbols) {
 			assert(*n.rule == typeid(rules::InstructionLeaRule));
 			return std::make_unique<InstructionLeaq>(
-				make_expr(n[0]),
-				make_expr(n[1]),
-				make_expr(n[2]),
+				make_expr(n[0], symbols),
+				make_expr(n[1], symbols),
+				make_expr(n[2], symbols),
 				convert_number_rule(n[3])->value
 			);
 		}
 
-		std::unique_ptr<Instruction> make_instruction(const ParseNode &n) {
+		std::unique_ptr<Instruction> make_instruction(const ParseNode &n, SymbolTable &symbols) {
 			const std::type_info &rule = *n.rule;
 			if (rule == typeid(rules::InstructionAssignmentCompareRule)) {
-				return convert_instruction_assignment_compare(n);
+				return convert_instruction_assignment_compare(n, symbols);
 			} else if (
 				rule == typeid(rules::InstructionAssignmentRule)
 				|| rule == typeid(rules::InstructionMemoryReadRule)
 				|| rule == typeid(rules::InstructionMemoryWriteRule)
 				|| rule == typeid(rules::InstructionStackArgRule)
 			) {
-				return make_pure_instruction_assignment(n);
+				return make_pure_instruction_assignment(n, symbols);
 			} else if (
 				rule == typeid(rules::InstructionPlusReadMemoryRule)
 				|| rule == typeid(rules::InstructionPlusWriteMemoryRule)
 			) {
-				return make_plus_instruction_assignment(n);
+				return make_plus_instruction_assignment(n, symbols);
 			} else if (
 				rule == typeid(rules::InstructionMinusReadMemoryRule)
 				|| rule == typeid(rules::InstructionMinusWriteMemoryRule)
 			) {
-				return make_minus_instruction_assignment(n);
+				return make_minus_instruction_assignment(n, symbols);
 			} else if (rule == typeid(rules::InstructionReturnRule)) {
 				return convert_instruction_return_rule(n);
 			} else if (
 				rule == typeid(rules::InstructionArithmeticOperationRule)
 				|| rule == typeid(rules::InstructionShiftOperationRule)
 			) {
-				return make_custom_op_instruction_assignment(n);
+				return make_custom_op_instruction_assignment(n, symbols);
 			} else if (rule == typeid(rules::InstructionCJumpRule)) {
-				return convert_instruction_cjump_rule(n);
+				return convert_instruction_cjump_rule(n, symbols);
 			} else if (rule == typeid(rules::InstructionLabelRule)) {
-				return convert_instruction_label_rule(n);
+				return convert_instruction_label_rule(n, symbols);
 			} else if (rule == typeid(rules::InstructionGotoLabelRule)) {
-				return convert_instruction_goto_label_rule(n);
+				return convert_instruction_goto_label_rule(n, symbols);
 			} else if (
 				rule == typeid(rules::InstructionFunctionCallRule)
 				|| rule == typeid(rules::InstructionStdCallRule)
 			) {
-				return make_instruction_call(n);
+				return make_instruction_call(n, symbols);
 			} else if (rule == typeid(rules::InstructionIncrementRule)) {
-				return convert_instruction_increment_rule(n);
+				return convert_instruction_increment_rule(n, symbols);
 			} else if (rule == typeid(rules::InstructionDecrementRule)) {
-				return convert_instruction_decrement_rule(n);
+				return convert_instruction_decrement_rule(n, symbols);
 			} else if (rule == typeid(rules::InstructionLeaRule)) {
-				auto x = convert_instruction_lea_rule(n);
+				auto x = convert_instruction_lea_rule(n, symbols);
 				return x;
 			} else {
-				std::cerr << "Cannot make Instruction from this parse node.";
-				exit(1);
+				throw CompileError("Cannot make Instruction from this parse node");
 			}
 		}
 
-		ptr<L2Function> make_l2_function(const ParseNode &n) {
+		ptr<L2Function> make_l2_function(const ParseNode &n, SymbolTable &symbols) {
 			assert(*n.rule == typeid(rules::FunctionRule));
+			std::string_view name = convert_name_rule(n[0][0]);
 			std::unique_ptr<L2Function> function = std::make_unique<L2Function>(
-				convert_name_rule(n[0][0]),
-				convert_number_rule(n[1])->value
+				symbols.intern(name),
+				name,
+				convert_number_rule(n[1])->value,
+				symbols
 			);
 
 			const ParseNode &instructions_rule = n[2];
 			assert(*instructions_rule.rule == typeid(rules::InstructionsRule));
 			for (const auto &child : instructions_rule.children) {
-				auto inst_thing = make_instruction(*child);
+				auto inst_thing = make_instruction(*child, symbols);
 				function->add_instruction(std::move(inst_thing));
 			}
 			return function;
@@ -917,89 +971,909 @@ namespace L2::parser {
 
 		std::unique_ptr<Program> convert_program_rule(const ParseNode &n) {
 			assert(*n.rule == typeid(rules::ProgramRule));
+			auto symbols = std::make_shared<SymbolTable>();
 			std::unique_ptr<Program> program = std::make_unique<Program>(
-				make_l2_function_ref(n[0])
+				make_l2_function_ref(n[0], *symbols),
+				symbols
 			);
 			add_predefined_registers_and_std(*program);
 
 			const ParseNode &functions_rule = n[1];
 			assert(*functions_rule.rule == typeid(rules::FunctionsRule));
 			for (const auto &function : functions_rule.children) {
-				program->add_l2_function(make_l2_function(*function));
+				program->add_l2_function(make_l2_function(*function, *symbols));
 			}
 			return program;
 		}
 	}
 
-	std::unique_ptr<Program> parse_file(char *fileName, std::optional<std::string> parse_tree_output) {
+	// Builds the IR directly from PEGTL actions as rules match, without
+	// materializing a ParseNode tree first. Operands are accumulated on an
+	// Expr stack and consumed by the action of the enclosing instruction rule.
+	namespace actions {
+		template<typename T>
+		using ptr = std::unique_ptr<T>;
+
+		struct ParseState {
+			// where the names of the parsed functions and program are
+			// interned; declared first so that it outlives them
+			std::shared_ptr<SymbolTable> symbols;
+			// the names interned so far, so that each distinct name takes
+			// the lock of this->symbols only once per parse. The keys are
+			// views into the input.
+			std::unordered_map<std::string_view, Symbol> interned;
+			std::vector<ptr<Expr>> exprs;
+			std::vector<std::size_t> marks; // sizes of this->exprs to roll back to on failure
+			AssignOperator assign_op;
+			ComparisonOperator cmp_op;
+			L2Function *function = nullptr; // the function whose instructions are being parsed
+			std::vector<ptr<L2Function>> functions; // parsed functions, in source order
+			ptr<Program> program;
+			std::string_view spill_var_name;
+			std::string_view spill_prefix;
+			// set while parsing a function body, so that its nodes go into
+			// the function's arena
+			std::optional<arena::UseArena> arena_in_use;
+
+			ParseState() : ParseState(std::make_shared<SymbolTable>()) {}
+
+			// parses names into the given table, e.g. that of the Program
+			// that the parsed functions will be added to
+			explicit ParseState(std::shared_ptr<SymbolTable> symbols) : symbols {std::move(symbols)} {}
+
+			~ParseState() {
+				// operands left over after an error may live in the arena of
+				// one of this->functions, so free them first
+				this->exprs.clear();
+			}
+
+			template<typename T>
+			// throws rather than asserting, so that malformed input can't
+			// abort a process that embeds the compiler
+			ptr<T> pop() {
+				if (this->exprs.empty()) {
+					throw CompileError("internal parser error: missing expression");
+				}
+				T *expr = dynamic_cast<T *>(this->exprs.back().get());
+				if (!expr) {
+					throw CompileError("internal parser error: unexpected expression " + this->exprs.back()->to_string());
+				}
+				this->exprs.back().release();
+				this->exprs.pop_back();
+				return ptr<T>(expr);
+			}
+
+			void push(ptr<Expr> &&expr) {
+				this->exprs.push_back(std::move(expr));
+			}
+
+			Symbol intern(std::string_view name) {
+				auto it = this->interned.find(name);
+				if (it == this->interned.end()) {
+					it = this->interned.emplace(name, this->symbols->intern(name)).first;
+				}
+				return it->second;
+			}
+
+			template<typename T>
+			void push_named(std::string_view name) {
+				this->push(std::make_unique<T>(this->intern(name), name));
+			}
+
+			void add_instruction(ptr<Instruction> &&inst) {
+				this->function->add_instruction(std::move(inst));
+			}
+		};
+
+		template<typename Rule, typename... Rules>
+		constexpr bool is_one_of = (std::is_same_v<Rule, Rules> || ...);
+
+		// Operand rules may push Exprs and then fail (e.g. the RegisterRule
+		// inside a failed rematch), so the rules that can backtrack past
+		// pushed operands restore the Expr stack when they fail.
+		template<typename Rule>
+		struct RollbackControl : pegtl::normal<Rule> {
+			template<typename ParseInput>
+			static void start(const ParseInput &in, ParseState &state) {
+				state.marks.push_back(state.exprs.size());
+			}
+
+			template<typename ParseInput>
+			static void success(const ParseInput &in, ParseState &state) {
+				state.marks.pop_back();
+			}
+
+			template<typename ParseInput>
+			static void failure(const ParseInput &in, ParseState &state) {
+				state.exprs.resize(state.marks.back());
+				state.marks.pop_back();
+			}
+		};
+
+		template<typename Rule>
+		struct Control : std::conditional_t<
+			is_one_of<
+				Rule,
+				rules::InexplicableSxRule,
+				rules::InexplicableARule,
+				rules::InexplicableWRule,
+				rules::InexplicableXRule,
+				rules::InexplicableTRule,
+				rules::InexplicableSRule,
+				rules::InexplicableURule,
+				rules::StackArgRule,
+				rules::MemoryLocationRule,
+				rules::LeaFactorRule,
+				rules::InstructionLeaRule,
+				rules::InstructionAssignmentCompareRule,
+				rules::InstructionAssignmentRule,
+				rules::InstructionReturnRule,
+				rules::InstructionMemoryReadRule,
+				rules::InstructionMemoryWriteRule,
+				rules::InstructionArithmeticOperationRule,
+				rules::InstructionStackArgRule,
+				rules::InstructionShiftOperationRule,
+				rules::InstructionPlusWriteMemoryRule,
+				rules::InstructionMinusWriteMemoryRule,
+				rules::InstructionPlusReadMemoryRule,
+				rules::InstructionMinusReadMemoryRule,
+				rules::InstructionCJumpRule,
+				rules::InstructionLabelRule,
+				rules::InstructionGotoLabelRule,
+				rules::InstructionFunctionCallRule,
+				rules::InstructionStdCallRule,
+				rules::InstructionIncrementRule,
+				rules::InstructionDecrementRule,
+				rules::FunctionRule,
+				rules::SpillFunctionRule
+			>,
+			RollbackControl<Rule>,
+			pegtl::normal<Rule>
+		> {};
+
+		template<typename Rule>
+		struct Action : pegtl::nothing<Rule> {};
+
+		template<>
+		struct Action<rules::NumberRule> {
+			template<typename ActionInput>
+			static void apply(const ActionInput &in, ParseState &state) {
+				state.push(std::make_unique<NumberLiteral>(
+					utils::string_view_to_int<int64_t>(in.string_view())
+				));
+			}
+		};
+
+		template<>
+		struct Action<rules::LabelRule> {
+			template<typename ActionInput>
+			static void apply(const ActionInput &in, ParseState &state) {
+				state.push_named<LabelRef>(in.string_view().substr(1));
+			}
+		};
+
+		template<>
+		struct Action<rules::FunctionNameRule> {
+			template<typename ActionInput>
+			static void apply(const ActionInput &in, ParseState &state) {
+				state.push_named<L2FunctionRef>(in.string_view().substr(1));
+			}
+		};
+
+		template<>
+		struct Action<rules::VariableRule> {
+			template<typename ActionInput>
+			static void apply(const ActionInput &in, ParseState &state) {
+				state.push_named<VariableRef>(in.string_view().substr(1));
+			}
+		};
+
+		template<>
+		struct Action<rules::RegisterRule> {
+			template<typename ActionInput>
+			static void apply(const ActionInput &in, ParseState &state) {
+				state.push_named<RegisterRef>(in.string_view());
+			}
+		};
+
+		template<>
+		struct Action<rules::StdFunctionNameRule> {
+			template<typename ActionInput>
+			static void apply(const ActionInput &in, ParseState &state) {
+				state.push_named<ExternalFunctionRef>(in.string_view());
+			}
+		};
+
+		template<>
+		struct Action<rules::StackArgRule> {
+			static void apply0(ParseState &state) {
+				state.push(std::make_unique<StackArg>(state.pop<NumberLiteral>()));
+			}
+		};
+
+		template<>
+		struct Action<rules::MemoryLocationRule> {
+			static void apply0(ParseState &state) {
+				ptr<NumberLiteral> offset = state.pop<NumberLiteral>();
+				ptr<Expr> base = state.pop<Expr>();
+				state.push(std::make_unique<MemoryLocation>(std::move(base), std::move(offset)));
+			}
+		};
+
+		template<>
+		struct Action<rules::ArithmeticOperatorRule> {
+			template<typename ActionInput>
+			static void apply(const ActionInput &in, ParseState &state) {
+				state.assign_op = str_to_ass_op(in.string_view());
+			}
+		};
+
+		template<>
+		struct Action<rules::ShiftOperatorRule> : Action<rules::ArithmeticOperatorRule> {};
+
+		template<>
+		struct Action<rules::ComparisonOperatorRule> {
+			template<typename ActionInput>
+			static void apply(const ActionInput &in, ParseState &state) {
+				state.cmp_op = str_to_cmp_op(in.string_view());
+			}
+		};
+
+		template<>
+		struct Action<rules::InstructionAssignmentCompareRule> {
+			static void apply0(ParseState &state) {
+				ptr<Expr> rhs = state.pop<Expr>();
+				ptr<Expr> lhs = state.pop<Expr>();
+				ptr<Expr> destination = state.pop<Expr>();
+				state.add_instruction(std::make_unique<InstructionCompareAssignment>(
+					std::move(destination),
+					state.cmp_op,
+					std::move(lhs),
+					std::move(rhs)
+				));
+			}
+		};
+
+		template<AssignOperator Op>
+		struct MakeAssignment {
+			static void apply0(ParseState &state) {
+				ptr<Expr> source = state.pop<Expr>();
+				ptr<Expr> destination = state.pop<Expr>();
+				state.add_instruction(std::make_unique<InstructionAssignment>(
+					Op,
+					std::move(source),
+					std::move(destination)
+				));
+			}
+		};
+
+		template<>
+		struct Action<rules::InstructionAssignmentRule> : MakeAssignment<AssignOperator::pure> {};
+		template<>
+		struct Action<rules::InstructionMemoryReadRule> : MakeAssignment<AssignOperator::pure> {};
+		template<>
+		struct Action<rules::InstructionMemoryWriteRule> : MakeAssignment<AssignOperator::pure> {};
+		template<>
+		struct Action<rules::InstructionStackArgRule> : MakeAssignment<AssignOperator::pure> {};
+		template<>
+		struct Action<rules::InstructionPlusReadMemoryRule> : MakeAssignment<AssignOperator::add> {};
+		template<>
+		struct Action<rules::InstructionPlusWriteMemoryRule> : MakeAssignment<AssignOperator::add> {};
+		template<>
+		struct Action<rules::InstructionMinusReadMemoryRule> : MakeAssignment<AssignOperator::subtract> {};
+		template<>
+		struct Action<rules::InstructionMinusWriteMemoryRule> : MakeAssignment<AssignOperator::subtract> {};
+
+		template<>
+		struct Action<rules::InstructionReturnRule> {
+			static void apply0(ParseState &state) {
+				state.add_instruction(std::make_unique<InstructionReturn>());
+			}
+		};
+
+		template<>
+		struct Action<rules::InstructionArithmeticOperationRule> {
+			static void apply0(ParseState &state) {
+				ptr<Expr> source = state.pop<Expr>();
+				ptr<Expr> destination = state.pop<Expr>();
+				state.add_instruction(std::make_unique<InstructionAssignment>(
+					state.assign_op,
+					std::move(source),
+					std::move(destination)
+				));
+			}
+		};
+
+		template<>
+		struct Action<rules::InstructionShiftOperationRule> : Action<rules::InstructionArithmeticOperationRule> {};
+
+		template<>
+		struct Action<rules::InstructionCJumpRule> {
+			static void apply0(ParseState &state) {
+				ptr<LabelRef> label = state.pop<LabelRef>();
+				ptr<Expr> rhs = state.pop<Expr>();
+				ptr<Expr> lhs = state.pop<Expr>();
+				state.add_instruction(std::make_unique<InstructionCompareJump>(
+					state.cmp_op,
+					std::move(lhs),
+					std::move(rhs),
+					std::move(label)
+				));
+			}
+		};
+
+		template<>
+		struct Action<rules::InstructionLabelRule> {
+			template<typename ActionInput>
+			static void apply(const ActionInput &in, ParseState &state) {
+				ptr<LabelRef> label = state.pop<LabelRef>();
+				state.add_instruction(std::make_unique<InstructionLabel>(label->get_ref_symbol(), label->get_ref_name()));
+			}
+		};
+
+		template<>
+		struct Action<rules::InstructionGotoLabelRule> {
+			static void apply0(ParseState &state) {
+				state.add_instruction(std::make_unique<InstructionGoto>(state.pop<LabelRef>()));
+			}
+		};
+
+		template<>
+		struct Action<rules::InstructionFunctionCallRule> {
+			static void apply0(ParseState &state) {
+				ptr<NumberLiteral> num_arguments = state.pop<NumberLiteral>();
+				ptr<Expr> callee = state.pop<Expr>();
+				state.add_instruction(std::make_unique<InstructionCall>(
+					std::move(callee),
+					num_arguments->value
+				));
+			}
+		};
+
+		template<>
+		struct Action<rules::InstructionStdCallRule> : Action<rules::InstructionFunctionCallRule> {};
+
+		template<AssignOperator Op>
+		struct MakeIncrement {
+			static void apply0(ParseState &state) {
+				state.add_instruction(std::make_unique<InstructionAssignment>(
+					Op,
+					std::make_unique<NumberLiteral>(1),
+					state.pop<Expr>()
+				));
+			}
+		};
+
+		template<>
+		struct Action<rules::InstructionIncrementRule> : MakeIncrement<AssignOperator::add> {};
+		template<>
+		struct Action<rules::InstructionDecrementRule> : MakeIncrement<AssignOperator::subtract> {};
+
+		template<>
+		struct Action<rules::InstructionLeaRule> {
+			static void apply0(ParseState &state) {
+				ptr<NumberLiteral> scale = state.pop<NumberLiteral>();
+				ptr<Expr> offset = state.pop<Expr>();
+				ptr<Expr> base = state.pop<Expr>();
+				ptr<Expr> destination = state.pop<Expr>();
+				state.add_instruction(std::make_unique<InstructionLeaq>(
+					std::move(destination),
+					std::move(base),
+					std::move(offset),
+					scale->value
+				));
+			}
+		};
+
+		// the function header has been parsed; instructions go into a new
+		// function from here on
+		template<>
+		struct Action<rules::ArgumentNumberRule> {
+			static void apply0(ParseState &state) {
+				ptr<NumberLiteral> num_arguments = state.pop<NumberLiteral>();
+				ptr<L2FunctionRef> name = state.pop<L2FunctionRef>();
+				state.functions.push_back(std::make_unique<L2Function>(
+					name->get_ref_symbol(),
+					name->get_ref_name(),
+					num_arguments->value,
+					*state.symbols
+				));
+				state.function = state.functions.back().get();
+				state.arena_in_use.reset();
+				state.arena_in_use.emplace(&state.function->arena);
+			}
+		};
+
+		template<>
+		struct Action<rules::FunctionBodyRule> {
+			static void apply0(ParseState &state) {
+				state.arena_in_use.reset();
+			}
+		};
+
+		template<>
+		struct Action<rules::SpillFunctionRule> {
+			static void apply0(ParseState &state) {
+				ptr<VariableRef> prefix = state.pop<VariableRef>();
+				ptr<VariableRef> var = state.pop<VariableRef>();
+				state.spill_var_name = var->get_ref_name();
+				state.spill_prefix = prefix->get_ref_name();
+			}
+		};
+
+		template<>
+		struct Action<rules::ProgramRule> {
+			static void apply0(ParseState &state) {
+				state.program = std::make_unique<Program>(state.pop<L2FunctionRef>(), state.symbols);
+				add_predefined_registers_and_std(*state.program);
+				for (ptr<L2Function> &function : state.functions) {
+					state.program->add_l2_function(std::move(function));
+				}
+				state.functions.clear();
+			}
+		};
+
+		// A module has no entry function of its own, so its Program is
+		// anchored on its first function. Calls into other modules are left
+		// as free names.
+		template<>
+		struct Action<rules::ModuleRule> {
+			static void apply0(ParseState &state) {
+				state.program = std::make_unique<Program>(
+					std::make_unique<L2FunctionRef>(state.functions.front()->symbol, state.functions.front()->get_name()),
+					state.symbols
+				);
+				add_predefined_registers_and_std(*state.program);
+				for (ptr<L2Function> &function : state.functions) {
+					state.program->add_l2_function(std::move(function));
+				}
+				state.functions.clear();
+			}
+		};
+
+		// wraps the single function that was parsed into a program
+		std::unique_ptr<Program> make_single_function_program(ParseState &state) {
+			ptr<L2Function> function = std::move(state.functions.at(0));
+			auto program = std::make_unique<Program>(
+				std::make_unique<L2FunctionRef>(function->symbol, function->get_name()),
+				state.symbols
+			);
+			add_predefined_registers_and_std(*program);
+			program->add_l2_function(std::move(function));
+			program->bind_free_names();
+			return program;
+		}
+	}
+
+	// A memory-mapped source file. The Program takes ownership of it so that
+	// the names in the IR can keep pointing into the mapping.
+	struct MappedSource : SourceBuffer {
+		pegtl::mmap_input<> input;
+
+		MappedSource(const char *fileName) : input(fileName) {}
+	};
+
+	// Finds the top-level function boundaries of a program without running
+	// the grammar, by matching parentheses outside of comments.
+	namespace prescan {
+		struct Span {
+			const char *begin;
+			const char *end;
+			std::size_t byte; // position of begin, for error messages
+			std::size_t line;
+			std::size_t column; // 1-based, as in pegtl::position
+		};
+
+		struct ProgramSpans {
+			Span header; // the text before the first function
+			std::vector<Span> functions; // each spans from its '(' to its ')'
+		};
+
+		class Scanner {
+			private:
+
+			const char *begin;
+			const char *end;
+			const char *pos;
+			std::size_t line;
+			const char *line_begin;
+
+			public:
+
+			Scanner(const char *begin, const char *end) :
+				begin {begin}, end {end}, pos {begin}, line {1}, line_begin {begin}
+			{}
+
+			bool at(char c) const { return this->pos != this->end && *this->pos == c; }
+
+			// the span from the given earlier state of this scanner to now
+			Span span_since(const Scanner &start) const {
+				return {
+					start.pos,
+					this->pos,
+					static_cast<std::size_t>(start.pos - this->begin),
+					start.line,
+					static_cast<std::size_t>(start.pos - start.line_begin) + 1
+				};
+			}
+
+			void advance() {
+				if (*this->pos == '\n') {
+					this->line += 1;
+					this->line_begin = this->pos + 1;
+				}
+				++this->pos;
+			}
+
+			// skips spaces, line breaks, and comments
+			void skip_separators() {
+				while (this->pos != this->end) {
+					if (this->at(' ') || this->at('\t') || this->at('\r') || this->at('\n')) {
+						this->advance();
+					} else if (this->at_comment()) {
+						this->skip_comment();
+					} else {
+						break;
+					}
+				}
+			}
+
+			// advances to the next '(' or ')' outside of a comment
+			void skip_to_paren() {
+				while (this->pos != this->end && !this->at('(') && !this->at(')')) {
+					if (this->at_comment()) {
+						this->skip_comment();
+					} else {
+						this->advance();
+					}
+				}
+			}
+
+			// Advances past the parenthesized group starting at the current
+			// '('. Returns false if the group is never closed.
+			bool skip_group() {
+				int depth = 0;
+				while (this->pos != this->end) {
+					this->skip_to_paren();
+					if (this->at('(')) {
+						depth += 1;
+					} else if (this->at(')')) {
+						depth -= 1;
+					} else {
+						return false;
+					}
+					this->advance();
+					if (depth == 0) {
+						return true;
+					}
+				}
+				return false;
+			}
+
+			private:
+
+			bool at_comment() const {
+				return this->end - this->pos >= 2 && this->pos[0] == '/' && this->pos[1] == '/';
+			}
+
+			void skip_comment() {
+				while (this->pos != this->end && *this->pos != '\n') {
+					++this->pos;
+				}
+			}
+		};
+
+		// Returns none if the text does not have the shape of a program, in
+		// which case the sequential parser should be used to report the
+		// error.
+		std::optional<ProgramSpans> find_function_spans(const char *begin, const char *end) {
+			const Scanner file_start(begin, end);
+			Scanner scanner = file_start;
+			scanner.skip_separators();
+			if (!scanner.at('(')) {
+				return {};
+			}
+			scanner.advance(); // the program's '('
+			scanner.skip_to_paren(); // the entry function name
+			if (!scanner.at('(')) {
+				return {};
+			}
+
+			ProgramSpans result;
+			result.header = scanner.span_since(file_start);
+			while (scanner.at('(')) {
+				Scanner function_start = scanner;
+				if (!scanner.skip_group()) {
+					return {};
+				}
+				result.functions.push_back(scanner.span_since(function_start));
+				scanner.skip_separators();
+			}
+			if (!scanner.at(')')) {
+				return {};
+			}
+			return std::make_optional(std::move(result));
+		}
+	}
+
+	// Runs the given parsing function, reporting syntax errors as
+	// CompileErrors.
+	template<typename F>
+	auto rethrow_parse_errors(F &&parse) -> decltype(parse()) {
+		try {
+			return parse();
+		} catch (const pegtl::parse_error &e) {
+			throw CompileError(e.what());
+		}
+	}
+
+	// Creates the Program from the text before its first function.
+	std::unique_ptr<Program> parse_program_header(const prescan::Span &header, const std::string &source_name) {
+		actions::ParseState state;
+		pegtl::memory_input<> input(header.begin, header.end, source_name);
+		pegtl::parse<pegtl::must<rules::ProgramHeaderRule, pegtl::eof>, actions::Action, actions::Control>(
+			input,
+			state
+		);
+		auto program = std::make_unique<Program>(state.pop<L2FunctionRef>(), state.symbols);
+		add_predefined_registers_and_std(*program);
+		return program;
+	}
+
+	// Parses each function of the program on a pool of worker threads and
+	// then attaches them to the Program in source order. Returns nullptr if
+	// the pre-scan could not split up the program.
+	std::unique_ptr<Program> parse_functions_in_parallel(
+		const char *begin,
+		const char *end,
+		const std::string &source_name,
+		int num_threads
+	) {
+		std::optional<prescan::ProgramSpans> spans = prescan::find_function_spans(begin, end);
+		if (!spans) {
+			return nullptr;
+		}
+
+		auto program = parse_program_header(spans->header, source_name);
+
+		std::size_t num_functions = spans->functions.size();
+		std::vector<std::unique_ptr<L2Function>> functions(num_functions);
+		std::vector<std::exception_ptr> errors(num_functions);
+		std::atomic<std::size_t> next_index = 0;
+		auto worker = [&]() {
+			for (std::size_t i = next_index++; i < num_functions; i = next_index++) {
+				const prescan::Span &span = spans->functions[i];
+				try {
+					actions::ParseState state(program->get_symbols());
+					pegtl::memory_input<> input(
+						span.begin,
+						span.end,
+						source_name,
+						span.byte,
+						span.line,
+						span.column
+					);
+					pegtl::parse<pegtl::must<rules::FunctionRule, pegtl::eof>, actions::Action, actions::Control>(
+						input,
+						state
+					);
+					functions[i] = std::move(state.functions.at(0));
+				} catch (...) {
+					errors[i] = std::current_exception();
+				}
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (std::size_t i = 1; i < std::min<std::size_t>(num_threads, num_functions); ++i) {
+			threads.emplace_back(worker);
+		}
+		worker();
+		for (std::thread &thread : threads) {
+			thread.join();
+		}
+
+		// report the first error in the file, regardless of which thread
+		// found it first
+		for (std::exception_ptr &error : errors) {
+			if (error) {
+				std::rethrow_exception(error);
+			}
+		}
+
+		for (std::unique_ptr<L2Function> &function : functions) {
+			program->add_l2_function(std::move(function));
+		}
+		return program;
+	}
+
+	// Parses only the program header and the headers of the functions. The
+	// body of each function is parsed the first time that the function is
+	// materialized. Returns nullptr if the pre-scan could not split up the
+	// program.
+	std::unique_ptr<Program> parse_file_lazily(
+		const char *begin,
+		const char *end,
+		const std::string &source_name
+	) {
+		std::optional<prescan::ProgramSpans> spans = prescan::find_function_spans(begin, end);
+		if (!spans) {
+			return nullptr;
+		}
+
+		auto program = parse_program_header(spans->header, source_name);
+		std::shared_ptr<SymbolTable> symbols = program->get_symbols();
+		for (const prescan::Span &span : spans->functions) {
+			actions::ParseState state(symbols);
+			pegtl::memory_input<> input(
+				span.begin,
+				span.end,
+				source_name,
+				span.byte,
+				span.line,
+				span.column
+			);
+			pegtl::parse<pegtl::must<rules::FunctionHeaderRule>, actions::Action, actions::Control>(
+				input,
+				state
+			);
+
+			const char *body_begin = input.current();
+			const char *body_end = span.end;
+			pegtl::position body_position = input.position();
+			std::unique_ptr<L2Function> function = std::move(state.functions.at(0));
+			// holds on to the symbol table, so that it doesn't depend on the
+			// Program; the Program re-attaches the function afterwards
+			function->body_parser = [=](L2Function &f) {
+				f.agg_scope.detach_parent();
+				actions::ParseState body_state(symbols);
+				body_state.function = &f;
+				body_state.arena_in_use.emplace(&f.arena);
+				pegtl::memory_input<> body_input(
+					body_begin,
+					body_end,
+					body_position.source,
+					body_position.byte,
+					body_position.line,
+					body_position.column
+				);
+				rethrow_parse_errors([&]() {
+					pegtl::parse<pegtl::must<rules::FunctionBodyRule, pegtl::eof>, actions::Action, actions::Control>(
+						body_input,
+						body_state
+					);
+				});
+			};
+			program->add_l2_function(std::move(function));
+		}
+		return program;
+	}
+
+	std::unique_ptr<Program> parse_file_with_tree(pegtl::mmap_input<> &fileInput, const std::string &parse_tree_output) {
 		// Check the grammar for some possible issues.
-		// TODO move this to a separate file bc it's performance-intensive
+		// This is performance-intensive, so only do it when debugging the
+		// grammar with the parse tree
 		if (pegtl::analyze<rules::EntryPointRule>() != 0) {
-			std::cerr << "There are problems with the grammar" << std::endl;
-			exit(1);
+			throw CompileError("There are problems with the grammar");
 		}
 
-		// Parse
-		pegtl::file_input<> fileInput(fileName);
 		auto root = pegtl::parse_tree::parse<rules::EntryPointRule, ParseNode, rules::Selector>(fileInput);
 		if (root) {
-			if (parse_tree_output.has_value()) {
-				std::ofstream output_fstream(*parse_tree_output);
-				if (output_fstream.is_open()) {
-					pegtl::parse_tree::print_dot(output_fstream, *root);
-					output_fstream.close();
-				}
+			std::ofstream output_fstream(parse_tree_output);
+			if (output_fstream.is_open()) {
+				pegtl::parse_tree::print_dot(output_fstream, *root);
+				output_fstream.close();
 			}
 
 			auto p = node_processor::convert_program_rule((*root)[0]);
-			p->get_scope().fake_bind_frees(); // If you want to allow unbound name
+			p->bind_free_names(); // If you want to allow unbound name
 			// p->get_scope().ensure_no_frees(); // If you want to error on unbound name
 			return p;
 		}
-		exit(1);
+		throw CompileError("could not parse " + fileInput.source());
 	}
+
+	// The text of the input must outlive the returned Program.
+	template<typename ParseInput>
+	std::unique_ptr<Program> parse_program_input(
+		ParseInput &input,
+		const std::string &source_name,
+		int num_threads,
+		bool lazy
+	) {
+		if (lazy) {
+			auto p = parse_file_lazily(input.begin(), input.end(), source_name);
+			if (p) {
+				p->bind_free_names();
+				return p;
+			}
+		}
+
+		if (num_threads > 1) {
+			auto p = parse_functions_in_parallel(input.begin(), input.end(), source_name, num_threads);
+			if (p) {
+				p->bind_free_names();
+				return p;
+			}
+		}
+
+		actions::ParseState state;
+		if (pegtl::parse<rules::EntryPointRule, actions::Action, actions::Control>(input, state)) {
+			state.program->bind_free_names(); // If you want to allow unbound name
+			// state.program->get_scope().ensure_no_frees(); // If you want to error on unbound name
+			return std::move(state.program);
+		}
+		throw CompileError("could not parse " + source_name);
+	}
+
+	std::unique_ptr<Program> parse_file(char *fileName, std::optional<std::string> parse_tree_output, int num_threads, bool lazy) {
+		return rethrow_parse_errors([&]() {
+			auto source = std::make_unique<MappedSource>(fileName);
+			std::unique_ptr<Program> p;
+			if (parse_tree_output.has_value()) {
+				p = parse_file_with_tree(source->input, *parse_tree_output);
+			} else {
+				p = parse_program_input(source->input, fileName, num_threads, lazy);
+			}
+			p->set_source(std::move(source));
+			return p;
+		});
+	}
+
+	std::unique_ptr<Program> parse_program(std::string_view source, const std::string &source_name, int num_threads, bool lazy) {
+		return rethrow_parse_errors([&]() {
+			pegtl::memory_input<> input(source.data(), source.size(), source_name);
+			return parse_program_input(input, source_name, num_threads, lazy);
+		});
+	}
+
 	std::unique_ptr<Program> parse_function_file(char *fileName) {
-		pegtl::file_input<> fileInput(fileName);
-		auto root = pegtl::parse_tree::parse<pegtl::must<rules::FunctionRule>, ParseNode, rules::Selector>(fileInput);
-		if (root) {
-			auto function = node_processor::make_l2_function((*root)[0]);
-			auto program = std::make_unique<Program>(
-				std::make_unique<L2FunctionRef>(function->get_name())
-			);
-			add_predefined_registers_and_std(*program);
-			program->add_l2_function(std::move(function));
-			program->get_scope().fake_bind_frees();
+		auto source = std::make_unique<MappedSource>(fileName);
+		actions::ParseState state;
+		bool parsed = rethrow_parse_errors([&]() {
+			return pegtl::parse<pegtl::must<rules::FunctionRule>, actions::Action, actions::Control>(source->input, state);
+		});
+		if (parsed) {
+			auto program = actions::make_single_function_program(state);
+			program->set_source(std::move(source));
 			return program;
 		}
 		return {};
 	}
 
+	std::unique_ptr<Program> parse_module_file(char *fileName) {
+		auto source = std::make_unique<MappedSource>(fileName);
+		actions::ParseState state;
+		bool parsed = rethrow_parse_errors([&]() {
+			return pegtl::parse<pegtl::must<rules::ModuleRule, pegtl::eof>, actions::Action, actions::Control>(source->input, state);
+		});
+		if (parsed) {
+			state.program->set_source(std::move(source));
+			return std::move(state.program);
+		}
+		return {};
+	}
+
 	std::unique_ptr<SpillProgram> parse_spill_file(char *fileName) {
-		pegtl::file_input<> fileInput(fileName);
-		auto root = pegtl::parse_tree::parse<pegtl::must<rules::SpillFunctionRule>, ParseNode, rules::Selector>(fileInput);
-		if (root) {
-			auto function = node_processor::make_l2_function((*root)[0][0]);
-			auto program = std::make_unique<Program>(
-				std::make_unique<L2FunctionRef>(function->get_name())
+		auto source = std::make_unique<MappedSource>(fileName);
+		actions::ParseState state;
+		bool parsed = rethrow_parse_errors([&]() {
+			return pegtl::parse<pegtl::must<rules::SpillFunctionRule>, actions::Action, actions::Control>(source->input, state);
+		});
+		if (parsed) {
+			auto program = actions::make_single_function_program(state);
+			program->set_source(std::move(source));
+			Variable *var = program->get_l2_function(0)->agg_scope.variable_scope.get_item_or_create(
+				state.intern(state.spill_var_name),
+				state.spill_var_name
 			);
-			add_predefined_registers_and_std(*program);
-			program->add_l2_function(std::move(function));
-			program->get_scope().fake_bind_frees();
-			std::string_view var_string_view = (*root)[0][1].string_view();
-			std::string_view prefix_view = (*root)[0][2].string_view();
-			std::string var_string = std::string(var_string_view);
-			std::string prefix_string = std::string(prefix_view);
-			var_string = var_string.substr(1);
-			std::string prefix = prefix_string.substr(1);
-			Variable *var = program->get_l2_function(0)->agg_scope.variable_scope.get_item_or_create(var_string);
 			std::unique_ptr<SpillProgram> spillProgram = std::make_unique<SpillProgram>(
 				std::move(program),
 				var,
-				prefix
+				std::string(state.spill_prefix)
 			);
 			return spillProgram;
 		}
 		return {};
 	}
 }
-
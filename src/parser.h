@@ -3,9 +3,20 @@
 #include "program.h"
 #include <memory>
 #include <optional>
+#include <string>
+#include <string_view>
 
+// Syntax errors are reported by throwing L2::program::CompileError.
 namespace L2::parser {
-	std::unique_ptr<L2::program::Program> parse_file(char *fileName, std::optional<std::string> parse_tree_output);
+	// if num_threads > 1, the functions of the program are parsed in parallel;
+	// if lazy, only the function headers are parsed up front and each body is
+	// parsed when its function is materialized
+	std::unique_ptr<L2::program::Program> parse_file(char *fileName, std::optional<std::string> parse_tree_output, int num_threads = 1, bool lazy = false);
+	// like parse_file, but the source must outlive the returned Program
+	std::unique_ptr<L2::program::Program> parse_program(std::string_view source, const std::string &source_name, int num_threads = 1, bool lazy = false);
 	std::unique_ptr<L2::program::Program> parse_function_file(char *fileName); // returns a program with exactly one function
+	// returns a program whose references to functions in other modules are
+	// still free
+	std::unique_ptr<L2::program::Program> parse_module_file(char *fileName);
 	std::unique_ptr<L2::program::SpillProgram> parse_spill_file(char *fileName);
 }
\ No newline at end of file
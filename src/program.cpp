@@ -4,6 +4,7 @@
 #include <utility>
 #include <functional>
 #include <charconv>
+#include <iterator>
 
 namespace L2::program {
 	std::string_view RegisterRef::get_ref_name() const {
@@ -23,16 +24,17 @@ namespace L2::program {
 	}
 
 	void RegisterRef::bind(Register *referent) {
+		this->symbol = referent->symbol;
 		this->referent = referent;
 	}
 
-	utils::set<Variable *> RegisterRef::get_vars_on_read() const {
+	VarList RegisterRef::get_vars_on_read() const {
 		if (this->referent->ignores_liveness) {
 			return {};
 		}
 		return {this->referent};
 	}
-	utils::set<Variable *> RegisterRef::get_vars_on_write(bool get_read_vars) const {
+	VarList RegisterRef::get_vars_on_write(bool get_read_vars) const {
 		if (this->referent->ignores_liveness) {
 			return {};
 		}
@@ -45,12 +47,14 @@ namespace L2::program {
 
 	RegisterRef::RegisterRef(Register* referent) :
 		Expr(),
+		symbol {referent->symbol},
 		free_name {},
 		referent {referent}
 	{}
 
-	RegisterRef::RegisterRef(const std::string_view &free_name) :
+	RegisterRef::RegisterRef(Symbol symbol, const std::string_view &free_name) :
 		Expr(),
+		symbol {symbol},
 		free_name {free_name},
 		referent {nullptr}
 	{}
@@ -63,11 +67,11 @@ namespace L2::program {
 		return "mem " + this->base->to_string() + " " + this->offset->to_string();
 	}
 
-	utils::set<Variable *> MemoryLocation::get_vars_on_read() const {
+	VarList MemoryLocation::get_vars_on_read() const {
 		return this->base->get_vars_on_read();
 	}
 
-	utils::set<Variable *> MemoryLocation::get_vars_on_write(bool get_read_vars) const {
+	VarList MemoryLocation::get_vars_on_write(bool get_read_vars) const {
 		// the base is read even if this MemoryLocation is being written
 		if (get_read_vars) {
 			return this->base->get_vars_on_read();
@@ -84,7 +88,8 @@ namespace L2::program {
 		return std::to_string(this->value);
 	}
 
-	LabelRef::LabelRef(const std::string_view &free_name) :
+	LabelRef::LabelRef(Symbol symbol, const std::string_view &free_name) :
+		symbol {symbol},
 		free_name {free_name},
 		referent {nullptr}
 	{}
@@ -109,21 +114,24 @@ namespace L2::program {
 		return ":" + std::string(this->get_ref_name());
 	}
 
-	VariableRef::VariableRef(const std::string_view &free_name) :
+	VariableRef::VariableRef(Symbol symbol, const std::string_view &free_name) :
+		symbol {symbol},
 		free_name {free_name},
 		referent {nullptr}
 	{}
 
 	VariableRef::VariableRef(Variable *referent) :
+		symbol {referent->symbol},
 		free_name {},
 		referent {referent}
 	{}
 
 	void VariableRef::bind_all(AggregateScope &agg_scope) {
-		this->bind(agg_scope.variable_scope.get_item_or_create(this->get_ref_name()));
+		this->bind(agg_scope.variable_scope.get_item_or_create(this->symbol, this->get_ref_name()));
 	}
 
 	void VariableRef::bind(Variable *referent) {
+		this->symbol = referent->symbol;
 		this->referent = referent;
 	}
 
@@ -139,11 +147,11 @@ namespace L2::program {
 		return "%" + std::string(this->get_ref_name());
 	}
 
-	utils::set<Variable *> VariableRef::get_vars_on_read() const {
+	VarList VariableRef::get_vars_on_read() const {
 		return {this->referent};
 	}
 
-	utils::set<Variable *> VariableRef::get_vars_on_write(bool get_read_vars) const {
+	VarList VariableRef::get_vars_on_write(bool get_read_vars) const {
 		if (get_read_vars) {
 			return {};
 		} else {
@@ -151,7 +159,8 @@ namespace L2::program {
 		}
 	}
 
-	L2FunctionRef::L2FunctionRef(const std::string_view &free_name) :
+	L2FunctionRef::L2FunctionRef(Symbol symbol, const std::string_view &free_name) :
+		symbol {symbol},
 		free_name {free_name},
 		referent {nullptr}
 	{}
@@ -176,7 +185,8 @@ namespace L2::program {
 		agg_scope.l2_function_scope.add_ref(*this);
 	}
 
-	ExternalFunctionRef::ExternalFunctionRef(const std::string_view &free_name) :
+	ExternalFunctionRef::ExternalFunctionRef(Symbol symbol, const std::string_view &free_name) :
+		symbol {symbol},
 		free_name {free_name},
 		referent {nullptr}
 	{}
@@ -279,11 +289,11 @@ namespace L2::program {
 	}
 
 	std::string InstructionLabel::to_string() const {
-		return ":" + this->label_name;
+		return ":" + std::string(this->label_name);
 	}
 
 	void InstructionLabel::bind_all(AggregateScope &agg_scope) {
-		agg_scope.label_scope.resolve_item(this->label_name, this);
+		agg_scope.label_scope.resolve_item(this->symbol, this->label_name, this);
 	}
 
 	std::string InstructionGoto::to_string() const {
@@ -321,66 +331,77 @@ namespace L2::program {
 		this->external_function_scope.set_parent(parent.external_function_scope);
 	}
 
+	AggregateScope::FreeSymbols AggregateScope::get_free_symbols() const {
+		return {
+			this->variable_scope.get_free_symbols(),
+			this->register_scope.get_free_symbols(),
+			this->label_scope.get_free_symbols(),
+			this->l2_function_scope.get_free_symbols(),
+			this->external_function_scope.get_free_symbols()
+		};
+	}
+
+	void AggregateScope::detach_parent() {
+		this->variable_scope.detach_parent();
+		this->register_scope.detach_parent();
+		this->label_scope.detach_parent();
+		this->l2_function_scope.detach_parent();
+		this->external_function_scope.detach_parent();
+	}
+
+	AggregateScope::AggregateScope(SymbolTable &symbols) :
+		variable_scope {symbols},
+		register_scope {symbols},
+		label_scope {symbols},
+		l2_function_scope {symbols},
+		external_function_scope {symbols},
+		owned_names {}
+	{}
+
+	std::string_view AggregateScope::own_name(std::string &&name) {
+		return this->owned_names.emplace_back(std::move(name));
+	}
+
+	void AggregateScope::clear() {
+		this->variable_scope.clear();
+		this->register_scope.clear();
+		this->label_scope.clear();
+		this->l2_function_scope.clear();
+		this->external_function_scope.clear();
+		this->owned_names.clear();
+	}
+
 	void AggregateScope::ensure_no_frees() const {
 		if (auto free_var_refs = this->variable_scope.get_free_refs(); !free_var_refs.empty()) {
-			std::cerr << "Error: unbound variable name " << free_var_refs[0]->get_ref_name() << "\n";
-			exit(1);
+			throw CompileError("unbound variable name " + std::string(free_var_refs[0]->get_ref_name()));
 		}
 		if (auto free_reg_refs = this->register_scope.get_free_refs(); !free_reg_refs.empty()) {
-			std::cerr << "Error: unbound register name " << free_reg_refs[0]->get_ref_name() << "\n";
-			exit(1);
+			throw CompileError("unbound register name " + std::string(free_reg_refs[0]->get_ref_name()));
 		}
 		if (auto free_label_refs = this->label_scope.get_free_refs(); !free_label_refs.empty()) {
-			std::cerr << "Error: unbound label " << free_label_refs[0]->get_ref_name() << "\n";
-			exit(1);
+			throw CompileError("unbound label " + std::string(free_label_refs[0]->get_ref_name()));
 		}
 		if (auto free_fun_refs = this->l2_function_scope.get_free_refs(); !free_fun_refs.empty()) {
-			std::cerr << "Error: unbound l2 function " << free_fun_refs[0]->get_ref_name() << "\n";
-			exit(1);
+			throw CompileError("unbound l2 function " + std::string(free_fun_refs[0]->get_ref_name()));
 		}
 		if (auto free_ext_fun_refs = this->external_function_scope.get_free_refs(); !free_ext_fun_refs.empty()) {
-			std::cerr << "Error: unbound std function " << free_ext_fun_refs[0]->get_ref_name() << "\n";
-			exit(1);
-		}
-	}
-
-	void AggregateScope::fake_bind_frees() {
-		// intentional memory leak
-		for (std::string name : this->variable_scope.get_free_names()) {
-			this->variable_scope.resolve_item(name, Variable(name));
-		}
-		for (std::string name : this->register_scope.get_free_names()) {
-			this->register_scope.resolve_item(name, Register(name, false, false, false, -1));
-		}
-		for (std::string name : this->label_scope.get_free_names()) {
-			this->label_scope.resolve_item(name, new InstructionLabel(name));
-		}
-		for (std::string name : this->l2_function_scope.get_free_names()) {
-			this->l2_function_scope.resolve_item(name, new L2Function(name, 0));
+			throw CompileError("unbound std function " + std::string(free_ext_fun_refs[0]->get_ref_name()));
 		}
-		for (std::string name : this->external_function_scope.get_free_names()) {
-			this->external_function_scope.resolve_item(name, new ExternalFunction(name, 0, false));
-		}
-		// this->variable_scope.fake_bind_frees(new Variable("FAKE_VARIABLE"));
-		// this->register_scope.fake_bind_frees(new Register("FAKE_REGISTER", false, false, false, -1));
-		// this->label_scope.fake_bind_frees(new InstructionLabel *(new InstructionLabel("FAKE_LABEL")));
-		// this->l2_function_scope.fake_bind_frees(new L2Function *(new L2Function("FAKE_L2_FUNCTION", 0)));
-		// this->external_function_scope.fake_bind_frees(new ExternalFunction *(new ExternalFunction("FAKE_EXTERNAL_FUNCTION", 0, false)));
 	}
 
 	std::string Variable::to_string() const {
-		return "%" + this->name;
+		return "%" + std::string(this->name);
 	}
 
 	std::string Register::to_string() const {
-		return this->name;
+		return std::string(this->name);
 	}
 
 	Function::Function(const std::string_view &name, int64_t num_arguments) :
 		name {name}, num_arguments {num_arguments}
 	{}
 
-	std::string Function::to_string() const { return this->name; }
+	std::string Function::to_string() const { return std::string(this->name); }
 
 	ExternalFunction::ExternalFunction(const std::string_view &name, int64_t num_arguments, bool never_returns) :
 		Function(name, num_arguments),
@@ -392,28 +413,358 @@ namespace L2::program {
 	}
 
 	L2Function::L2Function(
+		Symbol symbol,
 		const std::string_view &name,
-		int64_t num_arguments
+		int64_t num_arguments,
+		SymbolTable &symbols
 	) :
 		Function(name, num_arguments),
+		symbol {symbol},
+		arena {},
 		instructions {},
-		agg_scope {}
+		agg_scope {symbols},
+		referenced_variables {}
 	{}
 
 	void L2Function::add_instruction(std::unique_ptr<Instruction> &&inst) {
 		inst->bind_all(this->agg_scope);
 		this->instructions.push_back(std::move(inst));
+		this->referenced_variables.reset();
 	}
 
 	void L2Function::insert_instruction(int index, std::unique_ptr<Instruction> &&inst){
 		inst->bind_all(this->agg_scope);
 		this->instructions.insert(this->instructions.begin() + index, std::move(inst));
+		this->referenced_variables.reset();
 	}
 
 
+	std::vector<std::unique_ptr<Instruction>> L2Function::take_instructions() {
+		std::vector<std::unique_ptr<Instruction>> result = std::move(this->instructions);
+		this->instructions.clear();
+		return result;
+	}
+
+	void L2Function::append_bound_instruction(std::unique_ptr<Instruction> &&inst) {
+		this->instructions.push_back(std::move(inst));
+	}
+
+	void L2Function::replace_referenced_variable(const Variable *var, std::vector<Variable *> replacements) {
+		if (!this->referenced_variables) {
+			return;
+		}
+		std::vector<Variable *> &referenced = *this->referenced_variables;
+		auto var_it = std::find(referenced.begin(), referenced.end(), var);
+		if (var_it != referenced.end()) {
+			(*var_it)->index = Variable::unreferenced;
+			referenced.erase(var_it);
+		}
+
+		// all of a function's Variables are in its own scope, so
+		// get_all_items has them sorted by name
+		auto by_name = [](const Variable *a, const Variable *b) {
+			return a->name < b->name;
+		};
+		std::sort(replacements.begin(), replacements.end(), by_name);
+		std::vector<Variable *> merged;
+		merged.reserve(referenced.size() + replacements.size());
+		std::merge(
+			referenced.begin(),
+			referenced.end(),
+			replacements.begin(),
+			replacements.end(),
+			std::back_inserter(merged),
+			by_name
+		);
+		referenced = std::move(merged);
+	}
+
 	void L2Function::bind_all(AggregateScope &agg_scope) {
 		this->agg_scope.set_parent(agg_scope);
-		agg_scope.l2_function_scope.resolve_item(this->get_name(), this);
+		agg_scope.l2_function_scope.resolve_item(this->symbol, this->get_name(), this);
+	}
+
+	// the slot in the scope that refs to the given name are bound to
+	template<typename ItemScope>
+	auto get_slot(ItemScope &scope, Symbol symbol, std::string_view name) {
+		auto slot = scope.get_item_maybe(symbol);
+		if (!slot) {
+			throw CompileError("cannot copy a reference to unbound name " + std::string(name));
+		}
+		return *slot;
+	}
+
+	// Deep-copies Exprs. Refs in the copy are bound to the same Items as
+	// the originals, looking up the slots of those bound by pointer-to-slot
+	// in the given scope.
+	class ExprCloner : public ExprVisitor {
+		private:
+
+		AggregateScope &agg_scope;
+		std::unique_ptr<Expr> result;
+
+		public:
+
+		ExprCloner(AggregateScope &agg_scope) : agg_scope {agg_scope}, result {} {}
+
+		template<typename T = Expr>
+		std::unique_ptr<T> clone(Expr &expr) {
+			expr.accept(*this);
+			return std::unique_ptr<T>(static_cast<T *>(this->result.release()));
+		}
+
+		virtual void visit(RegisterRef &expr) override {
+			this->result = std::make_unique<RegisterRef>(expr.get_referent());
+		}
+		virtual void visit(NumberLiteral &expr) override {
+			this->result = std::make_unique<NumberLiteral>(expr.value);
+		}
+		virtual void visit(StackArg &expr) override {
+			this->result = std::make_unique<StackArg>(this->clone<NumberLiteral>(*expr.stack_num));
+		}
+		virtual void visit(MemoryLocation &expr) override {
+			std::unique_ptr<Expr> base = this->clone(*expr.base);
+			this->result = std::make_unique<MemoryLocation>(std::move(base), this->clone<NumberLiteral>(*expr.offset));
+		}
+		virtual void visit(LabelRef &expr) override {
+			auto ref = std::make_unique<LabelRef>(expr.get_ref_symbol(), expr.get_ref_name());
+			ref->bind(get_slot(this->agg_scope.label_scope, expr.get_ref_symbol(), expr.get_ref_name()));
+			this->result = std::move(ref);
+		}
+		virtual void visit(VariableRef &expr) override {
+			this->result = std::make_unique<VariableRef>(expr.get_referent());
+		}
+		virtual void visit(L2FunctionRef &expr) override {
+			auto ref = std::make_unique<L2FunctionRef>(expr.get_ref_symbol(), expr.get_ref_name());
+			ref->bind(get_slot(this->agg_scope.l2_function_scope, expr.get_ref_symbol(), expr.get_ref_name()));
+			this->result = std::move(ref);
+		}
+		virtual void visit(ExternalFunctionRef &expr) override {
+			auto ref = std::make_unique<ExternalFunctionRef>(expr.get_ref_symbol(), expr.get_ref_name());
+			ref->bind(get_slot(this->agg_scope.external_function_scope, expr.get_ref_symbol(), expr.get_ref_name()));
+			this->result = std::move(ref);
+		}
+
+	};
+
+	// Deep-copies Instructions. Copied InstructionLabels are not added to
+	// any scope.
+	class InstructionCloner : public InstructionVisitor {
+		private:
+
+		ExprCloner expr_cloner;
+		std::unique_ptr<Instruction> result;
+
+		public:
+
+		std::vector<InstructionLabel *> labels; // the copied labels, in order
+
+		InstructionCloner(AggregateScope &agg_scope) : expr_cloner(agg_scope), result {}, labels {} {}
+
+		std::unique_ptr<Instruction> clone(Instruction &inst) {
+			inst.accept(*this);
+			return std::move(this->result);
+		}
+
+		virtual void visit(InstructionReturn &inst) override {
+			this->result = std::make_unique<InstructionReturn>();
+		}
+		virtual void visit(InstructionAssignment &inst) override {
+			std::unique_ptr<Expr> source = this->expr_cloner.clone(*inst.source);
+			this->result = std::make_unique<InstructionAssignment>(
+				inst.op,
+				std::move(source),
+				this->expr_cloner.clone(*inst.destination)
+			);
+		}
+		virtual void visit(InstructionCompareAssignment &inst) override {
+			std::unique_ptr<Expr> destination = this->expr_cloner.clone(*inst.destination);
+			std::unique_ptr<Expr> lhs = this->expr_cloner.clone(*inst.lhs);
+			this->result = std::make_unique<InstructionCompareAssignment>(
+				std::move(destination),
+				inst.op,
+				std::move(lhs),
+				this->expr_cloner.clone(*inst.rhs)
+			);
+		}
+		virtual void visit(InstructionCompareJump &inst) override {
+			std::unique_ptr<Expr> lhs = this->expr_cloner.clone(*inst.lhs);
+			std::unique_ptr<Expr> rhs = this->expr_cloner.clone(*inst.rhs);
+			this->result = std::make_unique<InstructionCompareJump>(
+				inst.op,
+				std::move(lhs),
+				std::move(rhs),
+				this->expr_cloner.clone<LabelRef>(*inst.label)
+			);
+		}
+		virtual void visit(InstructionLabel &inst) override {
+			auto label = std::make_unique<InstructionLabel>(inst.symbol, inst.label_name);
+			this->labels.push_back(label.get());
+			this->result = std::move(label);
+		}
+		virtual void visit(InstructionGoto &inst) override {
+			this->result = std::make_unique<InstructionGoto>(this->expr_cloner.clone<LabelRef>(*inst.label));
+		}
+		virtual void visit(InstructionCall &inst) override {
+			this->result = std::make_unique<InstructionCall>(this->expr_cloner.clone(*inst.callee), inst.num_arguments);
+		}
+		virtual void visit(InstructionLeaq &inst) override {
+			std::unique_ptr<Expr> destination = this->expr_cloner.clone(*inst.destination);
+			std::unique_ptr<Expr> base = this->expr_cloner.clone(*inst.base);
+			this->result = std::make_unique<InstructionLeaq>(
+				std::move(destination),
+				std::move(base),
+				this->expr_cloner.clone(*inst.offset),
+				inst.scale
+			);
+		}
+	};
+
+	std::vector<std::unique_ptr<Instruction>> clone_instructions(
+		const std::vector<std::unique_ptr<Instruction>> &instructions,
+		InstructionCloner &cloner
+	) {
+		std::vector<std::unique_ptr<Instruction>> result;
+		result.reserve(instructions.size());
+		for (const std::unique_ptr<Instruction> &inst : instructions) {
+			result.push_back(cloner.clone(*inst));
+		}
+		return result;
+	}
+
+	L2FunctionSnapshot L2Function::snapshot() {
+		L2FunctionSnapshot result;
+		InstructionCloner cloner(this->agg_scope);
+		result.instructions = clone_instructions(this->instructions, cloner);
+		result.num_variables = this->agg_scope.variable_scope.size();
+		for (const Variable *var : this->agg_scope.variable_scope.get_own_items()) {
+			result.spillable.push_back(var->spillable);
+		}
+		result.num_owned_names = this->agg_scope.owned_names.size();
+		return result;
+	}
+
+	void L2Function::restore(const L2FunctionSnapshot &snapshot) {
+		InstructionCloner cloner(this->agg_scope);
+		this->instructions = clone_instructions(snapshot.instructions, cloner);
+
+		// the refs to each label are bound to its slot in the label scope,
+		// so pointing the slot at the copy rebinds all of them
+		for (InstructionLabel *label : cloner.labels) {
+			*get_slot(this->agg_scope.label_scope, label->symbol, label->label_name) = label;
+		}
+
+		this->referenced_variables.reset();
+		this->agg_scope.variable_scope.truncate(snapshot.num_variables);
+		const std::vector<Variable *> &variables = this->agg_scope.variable_scope.get_own_items();
+		for (std::size_t i = 0; i < snapshot.num_variables; ++i) {
+			variables[i]->spillable = snapshot.spillable[i];
+		}
+		// only the removed Variables used the names owned since
+		this->agg_scope.owned_names.resize(snapshot.num_owned_names);
+	}
+
+	bool L2Function::materialize() {
+		if (!this->body_parser) {
+			return false;
+		}
+		// clear the parser first so that it only ever runs once
+		std::function<void(L2Function &)> body_parser = std::move(this->body_parser);
+		this->body_parser = nullptr;
+		body_parser(*this);
+		return true;
+	}
+
+	void L2Function::release_body() {
+		this->instructions.clear();
+		this->instructions.shrink_to_fit();
+		this->referenced_variables.reset();
+		this->agg_scope.clear();
+		this->arena.release();
+	}
+
+	// marks the Variables referred to by the visited instructions by setting
+	// their index to 0
+	class VariableRefMarker : public InstructionVisitor, public ExprVisitor {
+		public:
+
+		virtual void visit(InstructionReturn &inst) override {}
+		virtual void visit(InstructionAssignment &inst) override {
+			inst.source->accept(*this);
+			inst.destination->accept(*this);
+		}
+		virtual void visit(InstructionCompareAssignment &inst) override {
+			inst.destination->accept(*this);
+			inst.lhs->accept(*this);
+			inst.rhs->accept(*this);
+		}
+		virtual void visit(InstructionCompareJump &inst) override {
+			inst.lhs->accept(*this);
+			inst.rhs->accept(*this);
+		}
+		virtual void visit(InstructionLabel &inst) override {}
+		virtual void visit(InstructionGoto &inst) override {}
+		virtual void visit(InstructionCall &inst) override {
+			inst.callee->accept(*this);
+		}
+		virtual void visit(InstructionLeaq &inst) override {
+			inst.destination->accept(*this);
+			inst.base->accept(*this);
+			inst.offset->accept(*this);
+		}
+
+		virtual void visit(RegisterRef &expr) override {}
+		virtual void visit(NumberLiteral &expr) override {}
+		virtual void visit(StackArg &expr) override {}
+		virtual void visit(MemoryLocation &expr) override {
+			expr.base->accept(*this);
+		}
+		virtual void visit(LabelRef &expr) override {}
+		virtual void visit(VariableRef &expr) override {
+			expr.get_referent()->index = 0;
+		}
+		virtual void visit(L2FunctionRef &expr) override {}
+		virtual void visit(ExternalFunctionRef &expr) override {}
+	};
+
+	std::vector<Variable *> L2Function::number_variables() {
+		// Spilling leaves the spilled Variables in the scope, since
+		// snapshots still refer to them; leave them out here so that they
+		// don't take up space in the analyses. Once they have been found,
+		// spills keep the list up to date, so that later rounds of register
+		// allocation don't walk every Variable ever spilled.
+		if (!this->referenced_variables) {
+			std::vector<Variable *> variables = this->agg_scope.variable_scope.get_all_items();
+			for (Variable *var : variables) {
+				var->index = Variable::unreferenced;
+			}
+			VariableRefMarker marker;
+			for (const std::unique_ptr<Instruction> &inst : this->instructions) {
+				inst->accept(marker);
+			}
+
+			std::vector<Variable *> &referenced = this->referenced_variables.emplace();
+			for (Variable *var : variables) {
+				if (var->index != Variable::unreferenced) {
+					referenced.push_back(var);
+				}
+			}
+		}
+
+		std::vector<Variable *> result = *this->referenced_variables;
+		for (Register *reg : this->agg_scope.register_scope.get_all_items()) {
+			result.push_back(reg);
+		}
+		for (std::size_t i = 0; i < result.size(); ++i) {
+			result[i]->index = i;
+		}
+		return result;
+	}
+
+	void L2Function::number_instructions() {
+		for (std::size_t i = 0; i < this->instructions.size(); ++i) {
+			this->instructions[i]->ordinal = i;
+		}
 	}
 
 	std::string L2Function::to_string() const {
@@ -430,11 +781,16 @@ namespace L2::program {
 
 	bool L2Function::get_never_returns() const { return false; }
 
-	Program::Program(std::unique_ptr<L2FunctionRef> &&entry_function_ref) :
+	Program::Program(std::unique_ptr<L2FunctionRef> &&entry_function_ref, std::shared_ptr<SymbolTable> symbols) :
+		source {},
+		symbols {std::move(symbols)},
 		entry_function_ref {std::move(entry_function_ref)},
 		l2_functions {},
 		external_functions {},
-		agg_scope {}
+		placeholder_labels {},
+		placeholder_l2_functions {},
+		placeholder_external_functions {},
+		agg_scope {*this->symbols}
 	{
 		this->agg_scope.l2_function_scope.add_ref(*(this->entry_function_ref));
 	}
@@ -448,13 +804,17 @@ namespace L2::program {
 		return result;
 	}
 
+	void Program::set_source(std::unique_ptr<SourceBuffer> &&source) {
+		this->source = std::move(source);
+	}
+
 	void Program::add_l2_function(std::unique_ptr<L2Function> &&func){
 		func->bind_all(this->agg_scope);
 		this->l2_functions.push_back(std::move(func));
 	}
 
 	void Program::add_external_function(std::unique_ptr<ExternalFunction> &&func) {
-		this->agg_scope.external_function_scope.resolve_item(func->get_name(), func.get());
+		this->agg_scope.external_function_scope.resolve_item(this->symbols->intern(func->get_name()), func->get_name(), func.get());
 		this->external_functions.push_back(std::move(func));
 	}
 
@@ -462,28 +822,149 @@ namespace L2::program {
 		return this->agg_scope;
 	}
 
-	L2Function *Program::get_l2_function(int index) {
-		return this->l2_functions.at(index).get();
-	}
-
-	std::vector<Register> generate_registers() {
-		std::vector<Register> result;
-		result.emplace_back("rax", false, true, false, -1);
-		result.emplace_back("rdi", false, false, false, 0);
-		result.emplace_back("rsi", false, false, false, 1);
-		result.emplace_back("rdx", false, false, false, 2);
-		result.emplace_back("rcx", false, false, false, 3);
-		result.emplace_back("r8", false, false, false, 4);
-		result.emplace_back("r9", false, false, false, 5);
-		result.emplace_back("r10", false, false, false, -1);
-		result.emplace_back("r11", false, false, false, -1);
-		result.emplace_back("r12", true, false, false, -1);
-		result.emplace_back("r13", true, false, false, -1);
-		result.emplace_back("r14", true, false, false, -1);
-		result.emplace_back("r15", true, false, false, -1);
-		result.emplace_back("rbx", true, false, false, -1);
-		result.emplace_back("rbp", true, false, false, -1);
-		result.emplace_back("rsp", true, false, true, -1);
+	void Program::bind_free_names() {
+		this->bind_to_placeholders(this->agg_scope.get_free_symbols());
+	}
+
+	void Program::bind_to_placeholders(const AggregateScope::FreeSymbols &free) {
+		// the placeholders must not land in the arena of a function body
+		arena::UseArena no_arena(nullptr);
+		AggregateScope &scope = this->agg_scope;
+		for (auto [symbol, name] : free.variables) {
+			if (scope.variable_scope.is_free(symbol)) {
+				scope.variable_scope.resolve_item(symbol, name, Variable(symbol, name));
+			}
+		}
+		for (auto [symbol, name] : free.registers) {
+			if (scope.register_scope.is_free(symbol)) {
+				scope.register_scope.resolve_item(symbol, name, Register(symbol, name, false, false, false, -1));
+			}
+		}
+		for (auto [symbol, name] : free.labels) {
+			if (scope.label_scope.is_free(symbol)) {
+				this->placeholder_labels.push_back(std::make_unique<InstructionLabel>(symbol, name));
+				scope.label_scope.resolve_item(symbol, name, this->placeholder_labels.back().get());
+			}
+		}
+		for (auto [symbol, name] : free.l2_functions) {
+			if (scope.l2_function_scope.is_free(symbol)) {
+				this->placeholder_l2_functions.push_back(std::make_unique<L2Function>(symbol, name, 0, *this->symbols));
+				scope.l2_function_scope.resolve_item(symbol, name, this->placeholder_l2_functions.back().get());
+			}
+		}
+		for (auto [symbol, name] : free.external_functions) {
+			if (scope.external_function_scope.is_free(symbol)) {
+				this->placeholder_external_functions.push_back(std::make_unique<ExternalFunction>(name, 0, false));
+				scope.external_function_scope.resolve_item(symbol, name, this->placeholder_external_functions.back().get());
+			}
+		}
+	}
+
+	void Program::materialize(L2Function &function) {
+		if (!function.materialize()) {
+			return;
+		}
+		// The rest of the program was bound when it was parsed, so only the
+		// names that the new body leaves free can need placeholders. They
+		// have to be collected first, since set_parent moves them to the
+		// program scope.
+		AggregateScope::FreeSymbols free = function.agg_scope.get_free_symbols();
+		function.agg_scope.set_parent(this->agg_scope);
+		this->bind_to_placeholders(free);
+	}
+
+	L2Function *Program::get_l2_function(std::size_t index) {
+		L2Function *function = this->l2_functions.at(index).get();
+		this->materialize(*function);
+		return function;
+	}
+
+	// collects the L2 functions referred to by the visited instructions
+	class L2FunctionRefCollector : public InstructionVisitor, public ExprVisitor {
+		public:
+
+		std::vector<L2Function *> referents;
+
+		virtual void visit(InstructionReturn &inst) override {}
+		virtual void visit(InstructionAssignment &inst) override {
+			inst.source->accept(*this);
+			inst.destination->accept(*this);
+		}
+		virtual void visit(InstructionCompareAssignment &inst) override {
+			inst.destination->accept(*this);
+			inst.lhs->accept(*this);
+			inst.rhs->accept(*this);
+		}
+		virtual void visit(InstructionCompareJump &inst) override {
+			inst.lhs->accept(*this);
+			inst.rhs->accept(*this);
+		}
+		virtual void visit(InstructionLabel &inst) override {}
+		virtual void visit(InstructionGoto &inst) override {}
+		virtual void visit(InstructionCall &inst) override {
+			inst.callee->accept(*this);
+		}
+		virtual void visit(InstructionLeaq &inst) override {
+			inst.destination->accept(*this);
+			inst.base->accept(*this);
+			inst.offset->accept(*this);
+		}
+
+		virtual void visit(RegisterRef &expr) override {}
+		virtual void visit(NumberLiteral &expr) override {}
+		virtual void visit(StackArg &expr) override {}
+		virtual void visit(MemoryLocation &expr) override {
+			expr.base->accept(*this);
+		}
+		virtual void visit(LabelRef &expr) override {}
+		virtual void visit(VariableRef &expr) override {}
+		virtual void visit(L2FunctionRef &expr) override {
+			this->referents.push_back(expr.get_referent());
+		}
+		virtual void visit(ExternalFunctionRef &expr) override {}
+	};
+
+	std::vector<L2Function *> Program::get_reachable_l2_functions() {
+		// functions that are fake-bound are not part of the program
+		std::set<L2Function *> unvisited;
+		for (const std::unique_ptr<L2Function> &function : this->l2_functions) {
+			unvisited.insert(function.get());
+		}
+
+		std::set<L2Function *> reachable;
+		std::vector<L2Function *> worklist = {this->entry_function_ref->get_referent()};
+		while (!worklist.empty()) {
+			L2Function *function = worklist.back();
+			worklist.pop_back();
+			if (!unvisited.erase(function)) {
+				continue;
+			}
+			reachable.insert(function);
+			this->materialize(*function);
+			L2FunctionRefCollector collector;
+			for (const std::unique_ptr<Instruction> &inst : function->instructions) {
+				inst->accept(collector);
+			}
+			worklist.insert(worklist.end(), collector.referents.begin(), collector.referents.end());
+		}
+
+		// keep the source order
+		std::vector<L2Function *> result;
+		for (const std::unique_ptr<L2Function> &function : this->l2_functions) {
+			if (reachable.count(function.get())) {
+				result.push_back(function.get());
+			}
+		}
+		return result;
+	}
+
+	RegisterTable get_register_table(const RegisterScope &register_scope) {
+		RegisterTable result = {};
+		for (const Register *reg : register_scope.get_all_items()) {
+			if (reg->id >= 0) {
+				result[reg->id] = reg;
+			}
+		}
 		return result;
 	}
 
@@ -498,12 +979,20 @@ namespace L2::program {
 	}
 
 	void add_predefined_registers_and_std(Program &program) {
+		// Built once per process. The std functions are never modified, so
+		// all programs (including ones compiled concurrently) bind to the
+		// same ones; each program gets its own copy of the registers.
+		static const std::vector<std::unique_ptr<ExternalFunction>> std_functions = generate_std_functions();
+
 		AggregateScope &program_scope = program.get_scope();
-		for (const Register &reg : generate_registers()) {
-			program_scope.register_scope.resolve_item(reg.name, std::move(reg));
+		SymbolTable &symbols = *program.get_symbols();
+		for (int id = 0; id < registers::count; ++id) {
+			std::string_view name = registers::table[id].name;
+			Symbol symbol = symbols.intern(name);
+			program_scope.register_scope.resolve_item(symbol, name, Register(symbol, id));
 		}
-		for (std::unique_ptr<ExternalFunction> &fn : generate_std_functions()) {
-			program.add_external_function(std::move(fn));
+		for (const std::unique_ptr<ExternalFunction> &fn : std_functions) {
+			program_scope.external_function_scope.resolve_item(symbols.intern(fn->get_name()), fn->get_name(), fn.get());
 		}
 	}
 }
@@ -1,19 +1,40 @@
 #pragma once
 
 #include "utils.h"
+#include "symbol.h"
+#include "arena.h"
+#include "registers.h"
+#include <algorithm>
+#include <numeric>
 #include <memory>
 #include <vector>
+#include <deque>
+#include <functional>
 #include <map>
+#include <unordered_map>
+#include <atomic>
 #include <optional>
 #include <string>
 #include <iostream>
 #include <string_view>
 #include <set>
 #include <type_traits>
+#include <stdexcept>
 
 namespace L2::program {
+	// Thrown for any error in the program being compiled, instead of exiting,
+	// so that the compiler can be embedded in a longer-lived process.
+	class CompileError : public std::runtime_error {
+		public:
+
+		using std::runtime_error::runtime_error;
+	};
+
 	struct Variable;
 	struct Register;
+
+	// the variables that an Expr reads or writes; there are never many
+	using VarList = utils::InlineVector<Variable *, 2>;
 	template<typename Item, typename ItemRef, bool DefineOnUse>
 	class Scope;
 	struct AggregateScope;
@@ -43,14 +64,20 @@ namespace L2::program {
 	class Expr {
 		public:
 
+		virtual ~Expr() = default;
+
+		// allocated in the current arena, if any; see arena.h
+		static void *operator new(std::size_t size) { return arena::allocate_node(size); }
+		static void operator delete(void *ptr) { arena::free_node(ptr); }
+
 		virtual std::string to_string() const = 0;
 
 		// which sub-values are read when this Expr is read
-		virtual utils::set<Variable *> get_vars_on_read() const {
+		virtual VarList get_vars_on_read() const {
 			return {};
 		}
 		// which sub-values are read/written when this Expr is written
-		virtual utils::set<Variable *> get_vars_on_write(bool get_read_vars) const {
+		virtual VarList get_vars_on_write(bool get_read_vars) const {
 			return {};
 		}
 		virtual void bind_all(AggregateScope &agg_scope) {}
@@ -59,18 +86,20 @@ namespace L2::program {
 
 	class RegisterRef : public Expr {
 		private:
+		Symbol symbol;
 		std::string_view free_name;
 		Register *referent;
 
 		public:
 
 		RegisterRef(Register* referent);
-		RegisterRef(const std::string_view &free_name);
+		RegisterRef(Symbol symbol, const std::string_view &free_name);
 
+		Symbol get_ref_symbol() const { return this->symbol; }
 		std::string_view get_ref_name() const;
 		virtual std::string to_string() const override;
-		virtual utils::set<Variable *> get_vars_on_read() const override;
-		virtual utils::set<Variable *> get_vars_on_write(bool get_read_vars) const override;
+		virtual VarList get_vars_on_read() const override;
+		virtual VarList get_vars_on_write(bool get_read_vars) const override;
 		virtual void bind_all(AggregateScope &agg_scope) override;
 		void bind(Register *referent);
 		Register *get_referent() const { return this->referent; }
@@ -111,8 +140,8 @@ namespace L2::program {
 		// {}
 
 		virtual std::string to_string() const override;
-		virtual utils::set<Variable *> get_vars_on_read() const override;
-		virtual utils::set<Variable *> get_vars_on_write(bool get_read_vars) const override;
+		virtual VarList get_vars_on_read() const override;
+		virtual VarList get_vars_on_write(bool get_read_vars) const override;
 		virtual void bind_all(AggregateScope &agg_scope) override;
 		virtual void accept(ExprVisitor &v) override {v.visit(*this); }
 	};
@@ -121,14 +150,16 @@ namespace L2::program {
 
 	class LabelRef : public Expr {
 		private:
-		std::string free_name;
+		Symbol symbol;
+		std::string_view free_name;
 		InstructionLabel **referent;
 
 		public:
 
-		LabelRef(const std::string_view &free_name);
+		LabelRef(Symbol symbol, const std::string_view &free_name);
 
 		void bind(InstructionLabel **referent);
+		Symbol get_ref_symbol() const { return this->symbol; }
 		std::string_view get_ref_name() const;
 		virtual std::string to_string() const override;
 		virtual void bind_all(AggregateScope &agg_scope) override;
@@ -141,20 +172,22 @@ namespace L2::program {
 		// the null-ness of this->referent determines whether this is a free
 		// or bound variable.
 		// once bound, this->name has no meaning and should never be used
+		Symbol symbol;
 		std::string_view free_name;
 		Variable *referent;
 
 		public:
 
 		// VariableRefs *must* be bound before the passed-in string_view becomes invalid
-		VariableRef(const std::string_view &free_name);
+		VariableRef(Symbol symbol, const std::string_view &free_name);
 		VariableRef(Variable *referent);
 
 		void bind(Variable *referent);
+		Symbol get_ref_symbol() const { return this->symbol; }
 		std::string_view get_ref_name() const;
 		virtual std::string to_string() const override;
-		virtual utils::set<Variable *> get_vars_on_read() const override;
-		virtual utils::set<Variable *> get_vars_on_write(bool get_read_vars) const override;
+		virtual VarList get_vars_on_read() const override;
+		virtual VarList get_vars_on_write(bool get_read_vars) const override;
 		virtual void bind_all(AggregateScope &agg_scope) override;
 		Variable *get_referent() const { return this->referent; }
 		virtual void accept(ExprVisitor &v) override {v.visit(*this); }
@@ -165,14 +198,16 @@ namespace L2::program {
 
 	class L2FunctionRef : public Expr {
 		private:
+		Symbol symbol;
 		std::string_view free_name;
 		L2Function **referent;
 
 		public:
 
-		L2FunctionRef(const std::string_view &free_name);
+		L2FunctionRef(Symbol symbol, const std::string_view &free_name);
 
 		void bind(L2Function **referent);
+		Symbol get_ref_symbol() const { return this->symbol; }
 		std::string_view get_ref_name() const;
 		virtual std::string to_string() const override;
 		virtual void bind_all(AggregateScope &agg_scope) override;
@@ -182,14 +217,16 @@ namespace L2::program {
 
 	class ExternalFunctionRef : public Expr {
 		private:
+		Symbol symbol;
 		std::string_view free_name;
 		ExternalFunction **referent;
 
 		public:
 
-		ExternalFunctionRef(const std::string_view &free_name);
+		ExternalFunctionRef(Symbol symbol, const std::string_view &free_name);
 
 		void bind(ExternalFunction **referent);
+		Symbol get_ref_symbol() const { return this->symbol; }
 		std::string_view get_ref_name() const;
 		virtual std::string to_string() const override;
 		virtual void bind_all(AggregateScope &agg_scope) override;
@@ -220,6 +257,14 @@ namespace L2::program {
 	};
 
 	struct Instruction {
+		std::size_t ordinal = 0; // position in its function; see L2Function::number_instructions
+
+		virtual ~Instruction() = default;
+
+		// allocated in the current arena, if any; see arena.h
+		static void *operator new(std::size_t size) { return arena::allocate_node(size); }
+		static void operator delete(void *ptr) { arena::free_node(ptr); }
+
 		virtual std::string to_string() const = 0;
 		virtual void accept(InstructionVisitor &v) = 0;
 		virtual void bind_all(AggregateScope &agg_scope) {}
@@ -333,9 +378,10 @@ namespace L2::program {
 	};
 
 	struct InstructionLabel : Instruction {
-		std::string label_name;
+		Symbol symbol;
+		std::string_view label_name;
 
-		InstructionLabel(const std::string_view &label_name) : label_name {label_name} {}
+		InstructionLabel(Symbol symbol, const std::string_view &label_name) : symbol {symbol}, label_name {label_name} {}
 
 		virtual std::string to_string() const override;
 		virtual void accept(InstructionVisitor &v) override { v.visit(*this); }
@@ -364,8 +410,7 @@ namespace L2::program {
 			num_arguments {num_arguments}
 		{
 			if (this->num_arguments < 0) {
-				std::cerr << "Error: negative number of call arguments.\n";
-				exit(-1);
+				throw CompileError("negative number of call arguments");
 			}
 		}
 		// InstructionCall(const InstructionCall &other) :
@@ -408,16 +453,25 @@ namespace L2::program {
 		virtual void bind_all(AggregateScope &agg_scope) override;
 	};
 
+	// Names are views into memory owned by the Program (the source buffer) or
+	// by the AggregateScope (names synthesized by the compiler).
 	struct Variable {
-		std::string name;
+		std::string_view name;
+		Symbol symbol; // the name's; what the Variable is keyed on in its scope
 		bool spillable;
+		// dense index among the Variables and Registers of the function last
+		// numbered; see L2Function::number_variables
+		std::size_t index = 0;
+		static const std::size_t unreferenced = SIZE_MAX; // an index for Variables left out of the numbering
 
-		Variable(const std::string_view &name) :
+		Variable(Symbol symbol, const std::string_view &name) :
 			name {name},
+			symbol {symbol},
 			spillable {true}
 		{}
-		Variable(const std::string &name, bool spillable) :
+		Variable(Symbol symbol, const std::string_view &name, bool spillable) :
 			name{name},
+			symbol {symbol},
 			spillable{spillable}
 		{}
 
@@ -431,19 +485,36 @@ namespace L2::program {
 		bool ignores_liveness; // only true for rsp
 		int argument_order; // the ordinal number of the argument; 0 for first
 		// -1 if not used as an argument
+		int id; // the position in registers::table; -1 if it is not in it
 
 		Register(
+			Symbol symbol,
 			const std::string_view &name,
 			bool is_callee_saved,
 			bool is_return_value,
 			bool ignores_liveness,
-			int argument_order
+			int argument_order,
+			int id = -1
 		) :
-			Variable(name),
+			Variable(symbol, name),
 			is_callee_saved {is_callee_saved},
 			is_return_value {is_return_value},
 			ignores_liveness {ignores_liveness},
-			argument_order {argument_order}
+			argument_order {argument_order},
+			id {id}
+		{}
+
+		// the register described by registers::table[id]
+		Register(Symbol symbol, int id) :
+			Register(
+				symbol,
+				registers::table[id].name,
+				registers::table[id].is_callee_saved,
+				registers::table[id].is_return_value,
+				registers::table[id].ignores_liveness,
+				registers::table[id].argument_order,
+				id
+			)
 		{}
 
 		virtual std::string to_string() const override;
@@ -452,14 +523,14 @@ namespace L2::program {
 	class Function {
 		private:
 
-		std::string name;
+		std::string_view name;
 		int64_t num_arguments; // -1 for unknown (this is okay for now because there is only one special case)
 
 		public:
 
 		Function(const std::string_view &name, int64_t num_arguments);
 
-		const std::string &get_name() const { return this->name; }
+		std::string_view get_name() const { return this->name; }
 		const int64_t get_num_arguments() const { return this->num_arguments; }
 		virtual bool get_never_returns() const = 0;
 		virtual std::string to_string() const;
@@ -483,84 +554,117 @@ namespace L2::program {
 	// `(name, ItemRef *)` in free_referrers represents that that ItemRef has
 	// refers to `name`, but that it is a free name (unbound to anything in this
 	// scope)
+	// Names are interned in the SymbolTable of the Program, and scopes are
+	// keyed on the Symbols alone, so no lookup hashes or compares a string.
 	// An ItemRef must have a
 	// - void ItemRef::bind(Item *referent) method that can be used to bind a free
 	// name to an Item once the item is encountered.
+	// - Symbol ItemRef::get_ref_symbol() method that can be used to get the
+	// name that the ItemRef refers to.
 	// - std::string_view ItemRef::get_ref_name() method that can be used to get
-	// the name that the ItemRef refers to.
+	// the text of that name.
 	//
-	// If DefineOnUse is true, Item must have a constructor that takes a name so
-	// that one can be created if it did not already exist.
+	// If DefineOnUse is true, Item must have a constructor that takes a Symbol
+	// and a name so that one can be created if it did not already exist.
 	template<typename Item, typename ItemRef, bool DefineOnUse>
 	class Scope {
 		private:
+		SymbolTable *symbols; // shared by this scope and all its relatives
 		// If a Scope has a parent, then it cannot have any
 		// free_refs; they must have been transferred to the parent.
 		std::optional<Scope *> parent;
-		std::map<std::string, Item, std::less<void>> dict;
-		std::map<std::string, std::vector<ItemRef *>, std::less<void>> free_refs;
+		// a node-based map, so that Items never move once added
+		std::unordered_map<Symbol, Item> dict;
+		// the Items of this->dict in the order they were added, so that
+		// iteration order doesn't depend on the order names were interned in
+		// (which can vary between runs when several threads are compiling)
+		std::vector<Item *> items_in_order;
+		std::vector<Symbol> symbols_in_order; // the keys of this->items_in_order
+		std::vector<std::string_view> names_in_order; // the names of this->items_in_order
+		// The Items visible from this scope that have been looked up, keyed
+		// the same way: all of its own, and those of its ancestors that it
+		// has bound refs to. Lookups probe this alone, and only go up the
+		// parent chain for a name that hasn't been seen here yet.
+		std::unordered_map<Symbol, Item *> visible;
+		std::unordered_map<Symbol, std::vector<ItemRef *>> free_refs;
+		// Set from a global counter whenever this scope's items or parent
+		// change, so that the newest version along the parent chain tells
+		// whether anything visible from this scope has changed.
+		uint64_t version;
+		// the result of get_all_items as of this->all_items_version
+		mutable std::vector<Item *> all_items;
+		mutable uint64_t all_items_version;
 
 		public:
 
-		Scope() : parent {}, dict {}, free_refs {} {}
+		explicit Scope(SymbolTable &symbols) :
+			symbols {&symbols},
+			parent {},
+			dict {},
+			items_in_order {},
+			symbols_in_order {},
+			names_in_order {},
+			visible {},
+			free_refs {},
+			version {next_scope_version()},
+			all_items {},
+			all_items_version {0}
+		{}
 		Scope(const Scope &other) = delete;
 
+		// Returns the Items of the ancestors of this scope followed by its
+		// own, each scope's sorted by name. The sorting is cached until an
+		// Item is added to any of them, but the result is a copy, so it
+		// stays valid however the scopes change afterwards.
+		std::vector<Item *> get_all_items() {
+			return this->get_cached_items();
+		}
+
 		std::vector<const Item *> get_all_items() const {
-			std::vector<const Item *> result;
-			if (this->parent) {
-				result = std::move(static_cast<const Scope *>(*this->parent)->get_all_items());
-			}
-			for (const auto &[name, item] : this->dict) {
-				result.push_back(&item);
-			}
-			return result;
+			const std::vector<Item *> &items = this->get_cached_items();
+			return std::vector<const Item *>(items.begin(), items.end());
 		}
 
-		std::vector<Item *> get_all_items() {
-			std::vector<Item *> result;
-			if (this->parent) {
-				result = std::move((*this->parent)->get_all_items());
-			}
-			for (auto &[name, item] : this->dict) {
-				result.push_back(&item);
-			}
-			return result;
+		// Returns the Items defined in this scope itself, in the order in
+		// which they were added.
+		const std::vector<Item *> &get_own_items() const {
+			return this->items_in_order;
+		}
+
+		// the table that this scope's names are interned in
+		SymbolTable &get_symbols() const {
+			return *this->symbols;
 		}
 
 		// returns whether the ref was immediately bound or was left as free
 		bool add_ref(ItemRef &item_ref) {
-			std::string_view ref_name = item_ref.get_ref_name();
-
-			std::optional<Item *> maybe_item_ptr = this->get_item_maybe(ref_name);
+			Symbol symbol = item_ref.get_ref_symbol();
+			std::optional<Item *> maybe_item_ptr = this->get_item_maybe(symbol);
 			if (maybe_item_ptr) {
 				// bind the ref to the item
 				item_ref.bind(*maybe_item_ptr);
 				return true;
 			} else {
 				// there is no definition of this name in the current scope
-				this->push_free_ref(item_ref);
+				this->push_free_ref(item_ref, symbol);
 				return false;
 			}
 		}
 
 		// Adds the specified item to this scope under the specified name,
-		// resolving all free refs who were depending on that name. Dies if
+		// resolving all free refs who were depending on that name. Throws if
 		// there already exists an item under that name.
-		void resolve_item(std::string name, Item item) {
-			auto existing_item_it = this->dict.find(name);
+		void resolve_item(Symbol symbol, std::string_view name, Item item) {
+			auto existing_item_it = this->dict.find(symbol);
 			if (existing_item_it != this->dict.end()) {
-				std::cerr << "name conflict: " << name << std::endl;
-				exit(-1);
+				throw CompileError("name conflict: " + std::string(name));
 			}
 
-			const auto [item_it, _] = this->dict.insert(std::make_pair(
-				name,
-				std::move(item)
-			));
-			auto free_refs_vec_it = this->free_refs.find(name);
+			Item *item_ptr = this->insert_item(symbol, name, std::move(item));
+			auto free_refs_vec_it = this->free_refs.find(symbol);
 			if (free_refs_vec_it != this->free_refs.end()) {
 				for (ItemRef *item_ref_ptr : free_refs_vec_it->second) {
-					item_ref_ptr->bind(&item_it->second);
+					item_ref_ptr->bind(item_ptr);
 				}
 				this->free_refs.erase(free_refs_vec_it);
 			}
@@ -573,72 +677,150 @@ namespace L2::program {
 		// gcc-toolset-11 doesn't seem to respect SFINAE, so just allow all
 		// instantiation sto use it and hope for the best.
 		// template<typename T = std::enable_if_t<DefineOnUse>>
-		Item *get_item_or_create(const std::string_view &name) {
-			std::optional<Item *> maybe_item_ptr = get_item_maybe(name);
+		// The name must outlive the created Item.
+		Item *get_item_or_create(Symbol symbol, const std::string_view &name) {
+			std::optional<Item *> maybe_item_ptr = this->get_item_maybe(symbol);
 			if (maybe_item_ptr) {
 				return *maybe_item_ptr;
 			} else {
-				const auto [item_it, _] = this->dict.insert(std::make_pair(
-					std::string(name),
-					Item(name)
-				));
-				return &item_it->second;
+				return this->insert_item(symbol, name, Item(symbol, name));
 			}
 		}
 
-		std::optional<Item *> get_item_maybe(const std::string_view &name) {
-			auto item_it = this->dict.find(name);
-			if (item_it == this->dict.end()) {
-				if (this->parent) {
-					return (*this->parent)->get_item_maybe(name);
-				} else {
-					return {};
-				}
-			} else {
-				return std::make_optional<Item *>(&item_it->second);
+		std::optional<Item *> get_item_maybe(Symbol symbol) {
+			auto item_it = this->visible.find(symbol);
+			if (item_it != this->visible.end()) {
+				return item_it->second;
+			}
+			if (!this->parent) {
+				return {};
+			}
+			std::optional<Item *> maybe_item_ptr = (*this->parent)->get_item_maybe(symbol);
+			if (maybe_item_ptr) {
+				this->visible.emplace(symbol, *maybe_item_ptr);
 			}
+			return maybe_item_ptr;
 		}
 
 		// Sets the given Scope as the parent of this Scope, transferring all
 		// current and future free names to the parent. If this scope already
-		// has a parent, dies.
+		// has a parent, throws.
 		void set_parent(Scope &parent) {
 			if (this->parent) {
-				std::cerr << "this scope already has a parent oops\n";
-				exit(-1);
+				throw CompileError("this scope already has a parent oops");
+			}
+			if (this->symbols != parent.symbols) {
+				throw CompileError("a scope's parent must intern names in the same table");
 			}
 
 			this->parent = std::make_optional<Scope *>(&parent);
-
-			for (auto &[name, our_free_refs_vec] : this->free_refs) {
-				for (ItemRef *our_free_ref : our_free_refs_vec) {
-					// TODO optimization here is possible; instead of using the
-					// public API of the parent we can just query the dictionary
-					// directly
-					(*this->parent)->add_ref(*our_free_ref);
+			this->version = next_scope_version();
+
+			// each name only needs to be looked up once, however many refs
+			// use it
+			for (auto &[symbol, our_free_refs_vec] : this->free_refs) {
+				std::optional<Item *> maybe_item_ptr = parent.get_item_maybe(symbol);
+				if (maybe_item_ptr) {
+					for (ItemRef *our_free_ref : our_free_refs_vec) {
+						our_free_ref->bind(*maybe_item_ptr);
+					}
+					this->visible.emplace(symbol, *maybe_item_ptr);
+				} else {
+					Scope *root = &parent;
+					while (root->parent) {
+						root = *root->parent;
+					}
+					std::vector<ItemRef *> &root_free_refs = root->free_refs[symbol];
+					root_free_refs.insert(root_free_refs.end(), our_free_refs_vec.begin(), our_free_refs_vec.end());
 				}
 			}
 			this->free_refs.clear();
 		}
 
-		// returns whether free refs exist in this scope for the given name
+		// Undoes set_parent, so that refs added afterwards stay free in this
+		// scope (to be resolved by Items added later) until set_parent is
+		// called again.
+		void detach_parent() {
+			this->parent = {};
+			this->visible.clear();
+			for (std::size_t i = 0; i < this->items_in_order.size(); ++i) {
+				this->visible.emplace(this->symbols_in_order[i], this->items_in_order[i]);
+			}
+			this->version = next_scope_version();
+		}
+
+		// the number of Items defined in this scope itself
+		std::size_t size() const {
+			return this->items_in_order.size();
+		}
+
+		// Removes the Items added after the first `count`. Any refs bound to
+		// the removed Items are left dangling.
+		void truncate(std::size_t count) {
+			for (std::size_t i = count; i < this->symbols_in_order.size(); ++i) {
+				this->dict.erase(this->symbols_in_order[i]);
+				// an ancestor's Item that the removed one shadowed is
+				// looked up again when next needed
+				this->visible.erase(this->symbols_in_order[i]);
+			}
+			if (count < this->items_in_order.size()) {
+				this->items_in_order.resize(count);
+				this->symbols_in_order.resize(count);
+				this->names_in_order.resize(count);
+				this->version = next_scope_version();
+			}
+		}
+
+		// Removes all Items and free refs from this scope, keeping its parent.
+		// Any refs bound to the removed Items are left dangling.
+		void clear() {
+			this->dict.clear();
+			this->items_in_order.clear();
+			this->symbols_in_order.clear();
+			this->names_in_order.clear();
+			this->visible.clear();
+			this->free_refs.clear();
+			this->all_items.clear();
+			this->all_items.shrink_to_fit();
+			this->version = next_scope_version();
+		}
+
+		// returns the free refs in this scope, grouped by name in name order
 		std::vector<ItemRef *> get_free_refs() const {
 			std::vector<ItemRef *> result;
-			for (auto &[name, free_refs_vec] : this->free_refs) {
+			for (const auto &[symbol, name] : this->get_free_symbols()) {
+				const std::vector<ItemRef *> &free_refs_vec = this->free_refs.at(symbol);
 				result.insert(result.end(), free_refs_vec.begin(), free_refs_vec.end());
 			}
 			return result;
 		}
 
-		// returns whether free refs exist in this scope for the given name
-		std::vector<std::string> get_free_names() const {
-			std::vector<std::string> result;
-			for (auto &[name, free_refs_vec] : this->free_refs) {
+		// returns the free names in this scope, sorted by name
+		std::vector<std::string_view> get_free_names() const {
+			std::vector<std::string_view> result;
+			for (const auto &[symbol, name] : this->get_free_symbols()) {
 				result.push_back(name);
 			}
 			return result;
 		}
 
+		bool is_free(Symbol symbol) const {
+			return this->free_refs.count(symbol) > 0;
+		}
+
+		// returns the free names in this scope with their Symbols, sorted by
+		// name
+		std::vector<std::pair<Symbol, std::string_view>> get_free_symbols() const {
+			std::vector<std::pair<Symbol, std::string_view>> result;
+			for (auto &[symbol, free_refs_vec] : this->free_refs) {
+				result.push_back({symbol, free_refs_vec.front()->get_ref_name()});
+			}
+			std::sort(result.begin(), result.end(), [](const auto &a, const auto &b) {
+				return a.second < b.second;
+			});
+			return result;
+		}
+
 		// // binds all free names to the given item
 		// void fake_bind_frees(Item *item_ptr) {
 		// 	for (auto &[name, free_refs_vec] : this->free_refs) {
@@ -653,16 +835,64 @@ namespace L2::program {
 
 		private:
 
+		static uint64_t next_scope_version() {
+			static std::atomic<uint64_t> counter = 0;
+			return ++counter;
+		}
+
+		Item *insert_item(Symbol symbol, std::string_view name, Item item) {
+			const auto [item_it, _] = this->dict.insert(std::make_pair(
+				symbol,
+				std::move(item)
+			));
+			this->items_in_order.push_back(&item_it->second);
+			this->symbols_in_order.push_back(symbol);
+			this->names_in_order.push_back(name);
+			// shadows any Item of an ancestor seen under the same name
+			this->visible[symbol] = &item_it->second;
+			this->version = next_scope_version();
+			return &item_it->second;
+		}
+
 		// Given an item_ref, exposes it as a ref with a free name. This may
 		// be caught by the parent Scope and resolved, or the parent might
 		// also expose it as a free ref recursively.
-		void push_free_ref(ItemRef &item_ref) {
-			std::string_view ref_name = item_ref.get_ref_name();
-			if (this->parent) {
-				(*this->parent)->add_ref(item_ref);
-			} else {
-				this->free_refs[std::string(ref_name)].push_back(&item_ref);
+		void push_free_ref(ItemRef &item_ref, Symbol symbol) {
+			Scope *root = this;
+			while (root->parent) {
+				root = *root->parent;
 			}
+			root->free_refs[symbol].push_back(&item_ref);
+		}
+
+		const std::vector<Item *> &get_cached_items() const {
+			uint64_t newest_version = 0;
+			for (const Scope *scope = this; ; scope = *scope->parent) {
+				newest_version = std::max(newest_version, scope->version);
+				if (!scope->parent) {
+					break;
+				}
+			}
+			if (this->all_items_version != newest_version) {
+				this->all_items.clear();
+				if (this->parent) {
+					const std::vector<Item *> &parent_items = (*this->parent)->get_cached_items();
+					this->all_items.insert(this->all_items.end(), parent_items.begin(), parent_items.end());
+				}
+				// Sorted by name, like the std::map these scopes used to be:
+				// the order of spill slots and the tie-breaks of the
+				// coloring follow it, so it decides the generated code.
+				std::vector<std::size_t> by_name(this->items_in_order.size());
+				std::iota(by_name.begin(), by_name.end(), 0);
+				std::sort(by_name.begin(), by_name.end(), [this](std::size_t a, std::size_t b) {
+					return this->names_in_order[a] < this->names_in_order[b];
+				});
+				for (std::size_t i : by_name) {
+					this->all_items.push_back(this->items_in_order[i]);
+				}
+				this->all_items_version = newest_version;
+			}
+			return this->all_items;
 		}
 	};
 
@@ -685,55 +915,154 @@ namespace L2::program {
 		LabelScope label_scope;
 		L2FunctionScope l2_function_scope;
 		ExternalFunctionScope external_function_scope;
+		std::deque<std::string> owned_names; // names synthesized after parsing
+
+		// the names free in each of the scopes, as given by
+		// Scope::get_free_symbols
+		struct FreeSymbols {
+			std::vector<std::pair<Symbol, std::string_view>> variables;
+			std::vector<std::pair<Symbol, std::string_view>> registers;
+			std::vector<std::pair<Symbol, std::string_view>> labels;
+			std::vector<std::pair<Symbol, std::string_view>> l2_functions;
+			std::vector<std::pair<Symbol, std::string_view>> external_functions;
+		};
 
+		explicit AggregateScope(SymbolTable &symbols);
+
+		SymbolTable &get_symbols() const { return this->variable_scope.get_symbols(); }
 		void set_parent(AggregateScope &parent);
+		void detach_parent();
+		// takes ownership of a name that does not come from the source, so
+		// that Items can refer to it
+		std::string_view own_name(std::string &&name);
 
+		void clear(); // removes all items defined in this scope
 		void ensure_no_frees() const; // fails if there are free names
-		void fake_bind_frees(); // adds fake bindings to free names; leaks memory
+		FreeSymbols get_free_symbols() const;
+	};
+
+	// A copy of the body of an L2Function, to roll it back to later. See
+	// L2Function::snapshot.
+	struct L2FunctionSnapshot {
+		std::vector<std::unique_ptr<Instruction>> instructions;
+		std::size_t num_variables;
+		std::vector<bool> spillable; // of the first num_variables Variables
+		std::size_t num_owned_names; // of AggregateScope::owned_names
 	};
 
 	class L2Function : public Function {
 		public: // TODO make actual specifiers
 
+		Symbol symbol; // of the function's name
+		arena::Arena arena; // declared before the nodes so that it is destroyed after them
 		std::vector<std::unique_ptr<Instruction>> instructions;
 		AggregateScope agg_scope;
-
-		L2Function(const std::string_view &name, int64_t num_arguments);
-		// L2Function(const L2Function &other) :
-		// 	instructions {},
-		// 	agg_scope {}
-		// {
-		// 	for (const std::unique_ptr<Instruction> &inst : other.instructions) {
-		// TODO how in the world is this supposed to work
-		// 	}
-		// }
+		// Set while the body has yet to be parsed (lazy mode); parses the
+		// body into the given function. Because the function is already
+		// bound by then, the parser must detach agg_scope from its parent
+		// while adding instructions (so that labels used before their
+		// definition are resolved locally). The Program that materializes
+		// the function re-attaches it afterwards.
+		std::function<void(L2Function &)> body_parser;
+		// The Variables that the instructions refer to, in the order of
+		// get_all_items, as found by the last number_variables and updated
+		// by replace_referenced_variable since. Unset once the instructions
+		// change in any other way.
+		std::optional<std::vector<Variable *>> referenced_variables;
+
+		// the function's names are interned in the given table, which must
+		// be the one of the Program that the function is added to
+		L2Function(Symbol symbol, const std::string_view &name, int64_t num_arguments, SymbolTable &symbols);
 
 		void add_instruction(std::unique_ptr<Instruction> &&inst);
 		void insert_instruction(int index, std::unique_ptr<Instruction> &&inst);
+		// For rewriting the body in one linear pass: takes all instructions
+		// out of this function, so that the pass can add them back (with
+		// append_bound_instruction, as they are already bound) along with
+		// new ones (with add_instruction). A pass that only appends bound
+		// instructions must report which Variables it replaced with
+		// replace_referenced_variable.
+		std::vector<std::unique_ptr<Instruction>> take_instructions();
+		void append_bound_instruction(std::unique_ptr<Instruction> &&inst);
+		// Notes that no instruction refers to `var` anymore, and that the
+		// given Variables are now referred to instead, so that the next
+		// number_variables doesn't have to find out again.
+		void replace_referenced_variable(const Variable *var, std::vector<Variable *> replacements);
 		void bind_all(AggregateScope &agg_scope);
+		// Copies the instructions and notes which Variables exist, so that
+		// passes that add instructions and Variables (like spilling) can be
+		// undone with restore. Labels and Variables are not copied; the
+		// copied instructions refer to the same ones.
+		L2FunctionSnapshot snapshot();
+		// Replaces the body with a copy of the snapshot's instructions and
+		// removes the Variables and owned names added since it was taken.
+		// The snapshot can be restored again later.
+		void restore(const L2FunctionSnapshot &snapshot);
+		// parses the body if it has not been parsed yet; returns whether it
+		// did, in which case agg_scope is left detached from its parent
+		bool materialize();
+		void release_body(); // frees the instructions and the items they defined
+		// Gives this function's Variables, followed by all Registers in
+		// scope, consecutive indices starting at 0, so that analyses can use
+		// flat tables. Returns them in index order. Variables that no
+		// instruction refers to anymore (such as spilled ones) are left out
+		// and get Variable::unreferenced. Any change to the function's
+		// variables invalidates the numbering.
+		std::vector<Variable *> number_variables();
+		// sets each instruction's ordinal to its position in this->instructions
+		void number_instructions();
 		virtual std::string to_string() const override;
 		bool get_never_returns() const override;
 	};
 
+	// Owns the memory that names parsed out of a source file point into, so
+	// that they can stay as string_views for as long as the Program lives.
+	class SourceBuffer {
+		public:
+
+		virtual ~SourceBuffer() = default;
+	};
+
 	class Program {
 		private:
 
+		std::unique_ptr<SourceBuffer> source; // declared first so that it is destroyed last
+		std::shared_ptr<SymbolTable> symbols; // outlives the scopes that use it
 		std::unique_ptr<L2FunctionRef> entry_function_ref;
 		std::vector<std::unique_ptr<L2Function>> l2_functions;
 		std::vector<std::unique_ptr<ExternalFunction>> external_functions;
+		// stand-ins for names that were never defined; see bind_free_names
+		std::vector<std::unique_ptr<InstructionLabel>> placeholder_labels;
+		std::vector<std::unique_ptr<L2Function>> placeholder_l2_functions;
+		std::vector<std::unique_ptr<ExternalFunction>> placeholder_external_functions;
 		AggregateScope agg_scope;
 
 		public:
 
-		Program(std::unique_ptr<L2FunctionRef> &&entry_function_ref);
+		Program(std::unique_ptr<L2FunctionRef> &&entry_function_ref, std::shared_ptr<SymbolTable> symbols);
 
 		std::string to_string() const;
+		void set_source(std::unique_ptr<SourceBuffer> &&source);
 		void add_l2_function(std::unique_ptr<L2Function> &&func);
 		void add_external_function(std::unique_ptr<ExternalFunction> &&func);
 		AggregateScope &get_scope();
-		L2Function *get_l2_function(int index);
+		const std::shared_ptr<SymbolTable> &get_symbols() const { return this->symbols; }
+		// binds the names still free in the program scope to placeholder
+		// items that live as long as this Program
+		void bind_free_names();
+		L2Function *get_l2_function(std::size_t index); // materializes the function
+		std::vector<L2Function *> get_reachable_l2_functions(); // materializes only those functions
 		const std::vector<std::unique_ptr<L2Function>> &get_l2_functions() const { return this->l2_functions; }
 		const L2FunctionRef &get_entry_function_ref() const { return *this->entry_function_ref; }
+
+		private:
+
+		// parses the body of one of this->l2_functions if it hasn't been
+		// yet, and binds the names that only the body uses
+		void materialize(L2Function &function);
+		// binds those of the given names that are still free in the program
+		// scope to placeholders
+		void bind_to_placeholders(const AggregateScope::FreeSymbols &free);
 	};
 
 	struct SpillProgram {
@@ -746,9 +1075,9 @@ namespace L2::program {
 		{}
 	};
 
-	// TODO we'd probably want something like a register table object that
-	// allows us to look stuff up easier but whatever
-	std::vector<Register> generate_registers();
+	// the Registers in scope indexed by id, with nullptr for those missing
+	using RegisterTable = std::array<const Register *, registers::count>;
+	RegisterTable get_register_table(const RegisterScope &register_scope);
 
 	std::vector<std::unique_ptr<ExternalFunction>> generate_std_functions();
 
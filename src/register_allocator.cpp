@@ -1,43 +1,53 @@
 #include "register_allocator.h"
 
 namespace L2::program::analyze {
-	std::vector<const Register *> create_register_color_table(RegisterScope &register_scope) {
-		static const std::vector<std::string> register_order = {
-			"rax", "rdi", "rsi", "rdx", "rcx",
-			"r8", "r9", "r10", "r11", "r12",
-			"r13", "r14", "r15", "rbx", "rbp"
-		};
-
+	// the colors are the allocatable registers, in id order
+	std::vector<const Register *> create_register_color_table(const RegisterScope &register_scope) {
+		RegisterTable register_table = get_register_table(register_scope);
 		std::vector<const Register *> color_table;
-		for (const std::string &reg_name : register_order) {
-			if (std::optional<Register *> reg = register_scope.get_item_maybe(reg_name); reg) {
-				color_table.push_back(*reg);
+		registers::for_each(registers::allocatable, [&](int id) {
+			if (register_table[id]) {
+				color_table.push_back(register_table[id]);
 			}
-		}
+		});
 		return color_table;
 	}
 
+	// assumes that every node is colored
 	RegAllocMap coloring_to_reg_alloc(
-		const std::map<VariableGraph::Node, VariableGraph::Color> &coloring,
+		const VariableGraph &graph,
 		const std::vector<const Register *> &register_color_table
 	) {
 		RegAllocMap result;
-		for (const auto &[var_ptr, color] : coloring) {
-			result.insert(std::make_pair(var_ptr, register_color_table[color]));
+		for (std::size_t i = 0; i < graph.size(); ++i) {
+			const VariableGraph::NodeInfo &node_info = graph.get_node_info(i);
+			if (node_info.node->index >= result.size()) {
+				result.resize(node_info.node->index + 1, nullptr);
+			}
+			result[node_info.node->index] = register_color_table[*node_info.color];
 		}
 		return result;
 	}
 
-	std::optional<RegAllocMap> allocate_and_spill(L2Function &l2_function, program::spiller::Spiller &spill_man) {
+	std::optional<RegAllocMap> allocate_and_spill(
+		L2Function &l2_function,
+		program::spiller::Spiller &spill_man,
+		std::optional<L2FunctionSnapshot> *backup
+	) {
 		std::vector<const Register *> register_color_table = create_register_color_table(l2_function.agg_scope.register_scope);
+		arena::Scratch &scratch = arena::thread_scratch();
+		arena::UseScratch use_scratch(&scratch);
 		while (true) {
-			InstructionsAnalysisResult liveness_results = analyze_instructions(l2_function);
-			VariableGraph graph = generate_interference_graph(l2_function, liveness_results, register_color_table);
+			// the temporaries of the previous round are gone by now
+			scratch.reset();
+			compact::CompactFunction compact_function = compact::encode(l2_function);
+			InstructionsAnalysisResult liveness_results = analyze_instructions(l2_function, compact_function);
+			VariableGraph graph = generate_interference_graph(l2_function, compact_function, liveness_results, register_color_table);
 			std::vector<const Variable *> spills = attempt_color_graph(graph, register_color_table);
 
 			if (spills.empty()) {
 				// It worked! Return this register allocation
-				return std::make_optional(coloring_to_reg_alloc(graph.get_coloring(), register_color_table));
+				return std::make_optional(coloring_to_reg_alloc(graph, register_color_table));
 			}
 
 			// this attempt did not work, spill a variable and try again
@@ -45,6 +55,9 @@ namespace L2::program::analyze {
 			for (auto it = spills.rbegin(); it != spills.rend(); ++it) {
 				const Variable *next_var = *it;
 				if (next_var->spillable) {
+					if (backup && !*backup) {
+						backup->emplace(l2_function.snapshot());
+					}
 					// program::spiller::spill(l2_function, next_var, get_next_prefix(l2_function, "s"), spill_calls);
 					spill_man.spill(next_var);
 					spillable_found = true;
@@ -61,30 +74,38 @@ namespace L2::program::analyze {
 	RegAllocMap allocate_and_spill_all(L2Function &l2_function, program::spiller::Spiller &spill_man) {
 		std::vector<const Register *> register_color_table = create_register_color_table(l2_function.agg_scope.register_scope);
 		spill_man.spill_all();
-		InstructionsAnalysisResult liveness_results = analyze_instructions(l2_function);
-		VariableGraph graph = generate_interference_graph(l2_function, liveness_results, register_color_table);
+		arena::Scratch &scratch = arena::thread_scratch();
+		arena::UseScratch use_scratch(&scratch);
+		scratch.reset();
+		compact::CompactFunction compact_function = compact::encode(l2_function);
+		InstructionsAnalysisResult liveness_results = analyze_instructions(l2_function, compact_function);
+		VariableGraph graph = generate_interference_graph(l2_function, compact_function, liveness_results, register_color_table);
 		std::vector<const Variable *> spills = attempt_color_graph(graph, register_color_table);
 		if (!spills.empty()) {
-			std::cerr << "Oops! Spilling all did not work\n";
-			exit(1);
+			throw CompileError("Oops! Spilling all did not work");
 		}
-		return coloring_to_reg_alloc(graph.get_coloring(), register_color_table);
+		return coloring_to_reg_alloc(graph, register_color_table);
 	}
 
 	RegAllocMap allocate_and_spill_with_backup(L2Function &l2_function) {
+		std::optional<L2FunctionSnapshot> original;
 		program::spiller::Spiller spill_man(l2_function, "S");
-		std::optional<RegAllocMap> normal_attempt = allocate_and_spill(l2_function, spill_man);
+		std::optional<RegAllocMap> normal_attempt = allocate_and_spill(l2_function, spill_man, &original);
 		if (normal_attempt) {
 			//std::cerr << "normal attempt was good enough\n";
 			return *normal_attempt;
 		}
 		//std::cerr << "normal attempt was NOT good enough\n";
 
-		// TODO just use a backup copy of the l2_function instead... once you
-		// figure out how to do that
+		// start over from the function as it was before the failed attempt
+		// spilled anything (if it did)
+		if (original) {
+			l2_function.restore(*original);
+		}
 		for (Variable *var : l2_function.agg_scope.variable_scope.get_all_items()) {
 			var->spillable = true;
 		}
-		return allocate_and_spill_all(l2_function, spill_man);
+		program::spiller::Spiller backup_spill_man(l2_function, "S");
+		return allocate_and_spill_all(l2_function, backup_spill_man);
 	}
 }
\ No newline at end of file
@@ -5,9 +5,10 @@
 #include "spiller.h"
 
 namespace L2::program::analyze {
-	std::vector<const Register *> create_register_color_table(RegisterScope &register_scope);
+	std::vector<const Register *> create_register_color_table(const RegisterScope &register_scope);
 
-	using RegAllocMap = std::map<const Variable *, const Register *>;
+	// indexed by Variable::index, as numbered by the final liveness analysis
+	using RegAllocMap = std::vector<const Register *>;
 
 	int get_next_prefix(L2Function &l2_function, std::string prefix);
 
@@ -17,8 +18,14 @@ namespace L2::program::analyze {
 
 	// returns a mapping from Variable *'s to Register *'s, or none if there
 	// was an error allocating registers. If there was an error, the user should
-	// call allocate_and_spill_all on a backup to get a guaranteed solution
-	std::optional<RegAllocMap> allocate_and_spill(L2Function &l2_function, program::spiller::Spiller &spill_man);
+	// call allocate_and_spill_all on a backup to get a guaranteed solution.
+	// If given, backup is set to a snapshot of the function just before the
+	// first spill, so that functions that need no spilling aren't copied.
+	std::optional<RegAllocMap> allocate_and_spill(
+		L2Function &l2_function,
+		program::spiller::Spiller &spill_man,
+		std::optional<L2FunctionSnapshot> *backup = nullptr
+	);
 
 	RegAllocMap allocate_and_spill_all(L2Function &l2_function, program::spiller::Spiller &spill_man);
 }
\ No newline at end of file
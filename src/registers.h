@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace L2::program::registers {
+	// A fixed description of an x86-64 register, known at compile time.
+	struct RegisterInfo {
+		std::string_view name;
+		bool is_callee_saved;
+		bool is_return_value;
+		bool ignores_liveness; // only true for rsp
+		int argument_order; // -1 if not used as an argument
+	};
+
+	// Every register of the target. A register's id is its position in this
+	// table. The allocatable registers come first, in the order in which they
+	// are handed out as colors.
+	inline constexpr std::array<RegisterInfo, 16> table = {{
+		{"rax", false, true, false, -1},
+		{"rdi", false, false, false, 0},
+		{"rsi", false, false, false, 1},
+		{"rdx", false, false, false, 2},
+		{"rcx", false, false, false, 3},
+		{"r8", false, false, false, 4},
+		{"r9", false, false, false, 5},
+		{"r10", false, false, false, -1},
+		{"r11", false, false, false, -1},
+		{"r12", true, false, false, -1},
+		{"r13", true, false, false, -1},
+		{"r14", true, false, false, -1},
+		{"r15", true, false, false, -1},
+		{"rbx", true, false, false, -1},
+		{"rbp", true, false, false, -1},
+		{"rsp", true, false, true, -1}
+	}};
+
+	inline constexpr int count = table.size();
+
+	// A set of registers, one bit per id.
+	using RegisterSet = uint16_t;
+	static_assert(count <= 16, "RegisterSet has a bit per register");
+
+	constexpr RegisterSet bit(int id) {
+		return static_cast<RegisterSet>(1u << id);
+	}
+
+	constexpr std::optional<int> find(std::string_view name) {
+		for (int id = 0; id < count; ++id) {
+			if (table[id].name == name) {
+				return id;
+			}
+		}
+		return {};
+	}
+
+	template<typename Predicate>
+	constexpr RegisterSet collect(Predicate predicate) {
+		RegisterSet result = 0;
+		for (int id = 0; id < count; ++id) {
+			if (predicate(table[id])) {
+				result |= bit(id);
+			}
+		}
+		return result;
+	}
+
+	// the registers whose liveness is tracked, i.e. all but rsp
+	inline constexpr RegisterSet allocatable = collect([](const RegisterInfo &info) {
+		return !info.ignores_liveness;
+	});
+	inline constexpr RegisterSet callee_saved = collect([](const RegisterInfo &info) {
+		return !info.ignores_liveness && info.is_callee_saved;
+	});
+	inline constexpr RegisterSet caller_saved = collect([](const RegisterInfo &info) {
+		return !info.ignores_liveness && !info.is_callee_saved;
+	});
+
+	inline constexpr int return_value = *find("rax");
+	inline constexpr int shift_amount = *find("rcx"); // the only register a shift can read its amount from
+	inline constexpr int stack_pointer = *find("rsp");
+
+	// the argument registers, in argument order
+	inline constexpr std::array<int, 6> arguments = [] {
+		std::array<int, 6> result = {};
+		for (int id = 0; id < count; ++id) {
+			if (table[id].argument_order >= 0) {
+				result[table[id].argument_order] = id;
+			}
+		}
+		return result;
+	}();
+
+	// the first num_arguments argument registers
+	constexpr RegisterSet first_arguments(int64_t num_arguments) {
+		RegisterSet result = 0;
+		for (int64_t i = 0; i < static_cast<int64_t>(arguments.size()) && i < num_arguments; ++i) {
+			result |= bit(arguments[i]);
+		}
+		return result;
+	}
+
+	// calls f(id) for each register in the set, in id order
+	template<typename F>
+	void for_each(RegisterSet set, F f) {
+		while (set != 0) {
+			int id = __builtin_ctz(set);
+			set &= set - 1;
+			f(id);
+		}
+	}
+}
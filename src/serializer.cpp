@@ -0,0 +1,491 @@
+#include "serializer.h"
+#include "program.h"
+#include <iostream>
+#include <fstream>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <map>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace L2::serializer {
+	using namespace L2::program;
+
+	// Layout:
+	//   magic, version
+	//   string entry function name
+	//   number of functions, then for each function:
+	//     string name, number of arguments
+	//     number of variables, then for each: string name, u8 spillable
+	//     number of instructions, then for each: u8 InstructionTag, operands
+	// where every integer is a LEB128 varint (zigzag-encoded if signed), a
+	// string is a length followed by that many bytes, and an Expr is a u8
+	// ExprTag followed by its operands. Variables are referred to by their
+	// index in the function's variable table.
+	static const char magic[4] = {'L', '2', 'B', '\0'};
+	static const uint32_t version = 1;
+
+	enum struct ExprTag : uint8_t {
+		register_ref,
+		number_literal,
+		stack_arg,
+		memory_location,
+		label_ref,
+		variable_ref,
+		l2_function_ref,
+		external_function_ref
+	};
+
+	enum struct InstructionTag : uint8_t {
+		ret,
+		assignment,
+		compare_assignment,
+		compare_jump,
+		label,
+		go_to,
+		call,
+		leaq
+	};
+
+	class Writer {
+		private:
+		std::ostream &o;
+
+		public:
+
+		Writer(std::ostream &o) : o {o} {}
+
+		// writes a single byte, e.g. a tag or flag
+		template<typename T>
+		void write(T value) {
+			this->o.put(static_cast<char>(value));
+		}
+
+		void write_uint(uint64_t value) {
+			while (value >= 0x80) {
+				this->o.put(static_cast<char>(value | 0x80));
+				value >>= 7;
+			}
+			this->o.put(static_cast<char>(value));
+		}
+
+		void write_int(int64_t value) {
+			this->write_uint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+		}
+
+		void write_string(std::string_view str) {
+			this->write_uint(str.size());
+			this->o.write(str.data(), str.size());
+		}
+	};
+
+	class ExprWriter : public ExprVisitor {
+		private:
+		Writer &w;
+		std::map<const Variable *, uint64_t> variable_indices;
+
+		public:
+
+		ExprWriter(Writer &w) : w {w} {}
+
+		void set_variables(const std::vector<const Variable *> &variables) {
+			this->variable_indices.clear();
+			for (uint64_t i = 0; i < variables.size(); ++i) {
+				this->variable_indices.insert({variables[i], i});
+			}
+		}
+
+		virtual void visit(RegisterRef &expr) override {
+			w.write(ExprTag::register_ref);
+			w.write_string(expr.get_ref_name());
+		}
+		virtual void visit(NumberLiteral &expr) override {
+			w.write(ExprTag::number_literal);
+			w.write_int(expr.value);
+		}
+		virtual void visit(StackArg &expr) override {
+			w.write(ExprTag::stack_arg);
+			w.write_int(expr.stack_num->value);
+		}
+		virtual void visit(MemoryLocation &expr) override {
+			w.write(ExprTag::memory_location);
+			expr.base->accept(*this);
+			w.write_int(expr.offset->value);
+		}
+		virtual void visit(LabelRef &expr) override {
+			w.write(ExprTag::label_ref);
+			w.write_string(expr.get_ref_name());
+		}
+		virtual void visit(VariableRef &expr) override {
+			w.write(ExprTag::variable_ref);
+			w.write_uint(this->variable_indices.at(expr.get_referent()));
+		}
+		virtual void visit(L2FunctionRef &expr) override {
+			w.write(ExprTag::l2_function_ref);
+			w.write_string(expr.get_ref_name());
+		}
+		virtual void visit(ExternalFunctionRef &expr) override {
+			w.write(ExprTag::external_function_ref);
+			w.write_string(expr.get_ref_name());
+		}
+	};
+
+	class InstructionWriter : public InstructionVisitor {
+		private:
+		Writer &w;
+		ExprWriter expr_w;
+
+		public:
+
+		InstructionWriter(Writer &w) : w {w}, expr_w(w) {}
+
+		void set_variables(const std::vector<const Variable *> &variables) {
+			this->expr_w.set_variables(variables);
+		}
+
+		virtual void visit(InstructionReturn &inst) override {
+			w.write(InstructionTag::ret);
+		}
+		virtual void visit(InstructionAssignment &inst) override {
+			w.write(InstructionTag::assignment);
+			w.write(inst.op);
+			inst.source->accept(expr_w);
+			inst.destination->accept(expr_w);
+		}
+		virtual void visit(InstructionCompareAssignment &inst) override {
+			w.write(InstructionTag::compare_assignment);
+			w.write(inst.op);
+			inst.destination->accept(expr_w);
+			inst.lhs->accept(expr_w);
+			inst.rhs->accept(expr_w);
+		}
+		virtual void visit(InstructionCompareJump &inst) override {
+			w.write(InstructionTag::compare_jump);
+			w.write(inst.op);
+			inst.lhs->accept(expr_w);
+			inst.rhs->accept(expr_w);
+			w.write_string(inst.label->get_ref_name());
+		}
+		virtual void visit(InstructionLabel &inst) override {
+			w.write(InstructionTag::label);
+			w.write_string(inst.label_name);
+		}
+		virtual void visit(InstructionGoto &inst) override {
+			w.write(InstructionTag::go_to);
+			w.write_string(inst.label->get_ref_name());
+		}
+		virtual void visit(InstructionCall &inst) override {
+			w.write(InstructionTag::call);
+			inst.callee->accept(expr_w);
+			w.write_int(inst.num_arguments);
+		}
+		virtual void visit(InstructionLeaq &inst) override {
+			w.write(InstructionTag::leaq);
+			inst.destination->accept(expr_w);
+			inst.base->accept(expr_w);
+			inst.offset->accept(expr_w);
+			w.write_int(inst.scale);
+		}
+	};
+
+	void write_program(Program &program, const std::string &fileName) {
+		std::ofstream o(fileName, std::ios::binary);
+		if (!o.is_open()) {
+			throw CompileError("could not open " + fileName + " for writing");
+		}
+		Writer w(o);
+		InstructionWriter inst_w(w);
+
+		o.write(magic, sizeof(magic));
+		w.write_uint(version);
+		w.write_string(program.get_entry_function_ref().get_ref_name());
+		w.write_uint(program.get_l2_functions().size());
+		for (std::size_t i = 0; i < program.get_l2_functions().size(); ++i) {
+			L2Function *f = program.get_l2_function(i);
+			w.write_string(f->get_name());
+			w.write_int(f->get_num_arguments());
+			std::vector<const Variable *> variables = static_cast<const L2Function &>(*f).agg_scope.variable_scope.get_all_items();
+			w.write_uint(variables.size());
+			for (const Variable *var : variables) {
+				w.write_string(var->name);
+				w.write<uint8_t>(var->spillable);
+			}
+			inst_w.set_variables(variables);
+			w.write_uint(f->instructions.size());
+			for (const std::unique_ptr<Instruction> &inst : f->instructions) {
+				inst->accept(inst_w);
+			}
+		}
+	}
+
+	// A read-only memory mapping of a whole file.
+	class MappedFile : public SourceBuffer {
+		private:
+		const char *data;
+		std::size_t size;
+
+		public:
+
+		MappedFile(const char *fileName) : data {nullptr}, size {0} {
+			int fd = open(fileName, O_RDONLY);
+			if (fd < 0) {
+				throw io_error("could not open", fileName);
+			}
+			struct stat st;
+			if (fstat(fd, &st) != 0) {
+				CompileError error = io_error("could not stat", fileName);
+				close(fd);
+				throw error;
+			}
+			if (st.st_size > 0) {
+				void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (mapping == MAP_FAILED) {
+					CompileError error = io_error("could not map", fileName);
+					close(fd);
+					throw error;
+				}
+				this->data = static_cast<const char *>(mapping);
+				this->size = st.st_size;
+			}
+			close(fd);
+		}
+		MappedFile(const MappedFile &other) = delete;
+		virtual ~MappedFile() override {
+			if (this->data) {
+				munmap(const_cast<char *>(this->data), this->size);
+			}
+		}
+
+		const char *begin() const { return this->data; }
+		const char *end() const { return this->data + this->size; }
+
+		private:
+
+		// names the failed operation and the reason that the system gave
+		static CompileError io_error(const char *what, const char *fileName) {
+			return CompileError(std::string(what) + " " + fileName + ": " + std::strerror(errno));
+		}
+	};
+
+	class Reader {
+		private:
+		const char *pos;
+		const char *end;
+		SymbolTable &symbols; // where the names read are interned
+
+		public:
+
+		// the variable table of the function currently being read
+		std::vector<Variable *> variables;
+
+		Reader(const char *begin, const char *end, SymbolTable &symbols) : pos {begin}, end {end}, symbols {symbols} {}
+
+		// reads a single byte, e.g. a tag or flag
+		template<typename T>
+		T read() {
+			T value = this->peek<T>();
+			++this->pos;
+			return value;
+		}
+
+		// the byte that read would return, without consuming it
+		template<typename T>
+		T peek() const {
+			this->ensure_available(1);
+			return static_cast<T>(static_cast<uint8_t>(*this->pos));
+		}
+
+		// reads an enumerator whose values run from 0 to last
+		template<typename T>
+		T read_enum(T last) {
+			uint8_t value = this->read<uint8_t>();
+			if (value > static_cast<uint8_t>(last)) {
+				corrupt();
+			}
+			return static_cast<T>(value);
+		}
+
+		uint64_t read_uint() {
+			uint64_t value = 0;
+			for (int shift = 0; ; shift += 7) {
+				if (shift >= 64) {
+					corrupt(); // longer than any uint64_t
+				}
+				uint8_t byte = this->read<uint8_t>();
+				value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+				if (!(byte & 0x80)) {
+					return value;
+				}
+			}
+		}
+
+		int64_t read_int() {
+			uint64_t value = this->read_uint();
+			return static_cast<int64_t>((value >> 1) ^ -(value & 1));
+		}
+
+		// the returned view points into the mapped file
+		std::string_view read_string() {
+			uint64_t size = this->read_uint();
+			this->ensure_available(size);
+			std::string_view result(this->pos, size);
+			this->pos += size;
+			return result;
+		}
+
+		// reads a name and constructs a T from its Symbol and text
+		template<typename T>
+		std::unique_ptr<T> read_named() {
+			std::string_view name = this->read_string();
+			return std::make_unique<T>(this->symbols.intern(name), name);
+		}
+
+		std::unique_ptr<NumberLiteral> read_number() {
+			return std::make_unique<NumberLiteral>(this->read_int());
+		}
+
+		std::unique_ptr<Expr> read_expr() {
+			switch (this->read<ExprTag>()) {
+				case ExprTag::register_ref:
+					return this->read_named<RegisterRef>();
+				case ExprTag::number_literal:
+					return this->read_number();
+				case ExprTag::stack_arg:
+					return std::make_unique<StackArg>(this->read_number());
+				case ExprTag::memory_location: {
+					// nothing that parses has a memory location as the base
+					// of another, and allowing it would let a corrupt file
+					// nest them deep enough to overflow the stack
+					if (this->peek<ExprTag>() == ExprTag::memory_location) {
+						corrupt();
+					}
+					std::unique_ptr<Expr> base = this->read_expr();
+					return std::make_unique<MemoryLocation>(std::move(base), this->read_number());
+				}
+				case ExprTag::label_ref:
+					return this->read_named<LabelRef>();
+				case ExprTag::variable_ref: {
+					uint64_t index = this->read_uint();
+					if (index >= this->variables.size()) {
+						corrupt();
+					}
+					return std::make_unique<VariableRef>(this->variables[index]);
+				}
+				case ExprTag::l2_function_ref:
+					return this->read_named<L2FunctionRef>();
+				case ExprTag::external_function_ref:
+					return this->read_named<ExternalFunctionRef>();
+			}
+			corrupt();
+		}
+
+		std::unique_ptr<Instruction> read_instruction() {
+			switch (this->read<InstructionTag>()) {
+				case InstructionTag::ret:
+					return std::make_unique<InstructionReturn>();
+				case InstructionTag::assignment: {
+					AssignOperator op = this->read_enum(AssignOperator::rshift);
+					std::unique_ptr<Expr> source = this->read_expr();
+					std::unique_ptr<Expr> destination = this->read_expr();
+					return std::make_unique<InstructionAssignment>(op, std::move(source), std::move(destination));
+				}
+				case InstructionTag::compare_assignment: {
+					ComparisonOperator op = this->read_enum(ComparisonOperator::eq);
+					std::unique_ptr<Expr> destination = this->read_expr();
+					std::unique_ptr<Expr> lhs = this->read_expr();
+					std::unique_ptr<Expr> rhs = this->read_expr();
+					return std::make_unique<InstructionCompareAssignment>(
+						std::move(destination), op, std::move(lhs), std::move(rhs)
+					);
+				}
+				case InstructionTag::compare_jump: {
+					ComparisonOperator op = this->read_enum(ComparisonOperator::eq);
+					std::unique_ptr<Expr> lhs = this->read_expr();
+					std::unique_ptr<Expr> rhs = this->read_expr();
+					return std::make_unique<InstructionCompareJump>(
+						op, std::move(lhs), std::move(rhs), this->read_named<LabelRef>()
+					);
+				}
+				case InstructionTag::label:
+					return this->read_named<InstructionLabel>();
+				case InstructionTag::go_to:
+					return std::make_unique<InstructionGoto>(this->read_named<LabelRef>());
+				case InstructionTag::call: {
+					std::unique_ptr<Expr> callee = this->read_expr();
+					return std::make_unique<InstructionCall>(std::move(callee), this->read_int());
+				}
+				case InstructionTag::leaq: {
+					std::unique_ptr<Expr> destination = this->read_expr();
+					std::unique_ptr<Expr> base = this->read_expr();
+					std::unique_ptr<Expr> offset = this->read_expr();
+					return std::make_unique<InstructionLeaq>(
+						std::move(destination), std::move(base), std::move(offset), this->read_int()
+					);
+				}
+			}
+			corrupt();
+		}
+
+		private:
+
+		void ensure_available(std::size_t num_bytes) const {
+			if (static_cast<std::size_t>(this->end - this->pos) < num_bytes) {
+				corrupt();
+			}
+		}
+
+		[[noreturn]] static void corrupt() {
+			throw CompileError("corrupt serialized program");
+		}
+	};
+
+	bool is_serialized_program(const char *fileName) {
+		std::ifstream i(fileName, std::ios::binary);
+		char header[sizeof(magic)];
+		return i.read(header, sizeof(header)) && std::memcmp(header, magic, sizeof(magic)) == 0;
+	}
+
+	std::unique_ptr<Program> load_program(const char *fileName) {
+		auto mapped_file = std::make_unique<MappedFile>(fileName);
+		auto symbols = std::make_shared<SymbolTable>();
+		Reader r(mapped_file->begin(), mapped_file->end(), *symbols);
+		for (char c : magic) {
+			if (r.read<char>() != c) {
+				throw CompileError(std::string(fileName) + " is not a serialized program");
+			}
+		}
+		if (r.read_uint() != version) {
+			throw CompileError(std::string(fileName) + " was serialized by an incompatible version");
+		}
+
+		auto program = std::make_unique<Program>(r.read_named<L2FunctionRef>(), symbols);
+		add_predefined_registers_and_std(*program);
+		uint64_t num_functions = r.read_uint();
+		for (uint64_t i = 0; i < num_functions; ++i) {
+			std::string_view name = r.read_string();
+			int64_t num_arguments = r.read_int();
+			auto function = std::make_unique<L2Function>(symbols->intern(name), name, num_arguments, *symbols);
+			arena::UseArena use_arena(&function->arena);
+			uint64_t num_variables = r.read_uint();
+			r.variables.clear();
+			for (uint64_t j = 0; j < num_variables; ++j) {
+				std::string_view var_name = r.read_string();
+				Variable *var = function->agg_scope.variable_scope.get_item_or_create(symbols->intern(var_name), var_name);
+				var->spillable = r.read_enum<uint8_t>(1);
+				r.variables.push_back(var);
+			}
+			uint64_t num_instructions = r.read_uint();
+			for (uint64_t j = 0; j < num_instructions; ++j) {
+				function->add_instruction(r.read_instruction());
+			}
+			program->add_l2_function(std::move(function));
+		}
+		program->bind_free_names();
+		program->set_source(std::move(mapped_file));
+		return program;
+	}
+}
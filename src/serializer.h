@@ -0,0 +1,18 @@
+#pragma once
+
+#include "program.h"
+#include <memory>
+#include <string>
+
+// A compact binary form of a parsed and bound Program (a ".L2b" file), so
+// that later steps of a pipeline can skip parsing the L2 text.
+namespace L2::serializer {
+	void write_program(L2::program::Program &program, const std::string &fileName);
+
+	// whether the file starts with the magic bytes of a serialized program
+	bool is_serialized_program(const char *fileName);
+
+	// Memory-maps the file and rebuilds the bound IR from it. Names in the IR
+	// are views into the mapping, which the returned Program owns.
+	std::unique_ptr<L2::program::Program> load_program(const char *fileName);
+}
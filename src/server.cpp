@@ -0,0 +1,302 @@
+#include "server.h"
+#include "l2c.h"
+#include "arena.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace L2::server {
+	std::optional<std::string> LruFunctionCodeCache::get(const std::string &key) {
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			auto it = this->index.find(key);
+			if (it != this->index.end()) {
+				this->entries.splice(this->entries.begin(), this->entries, it->second);
+				return it->second->second;
+			}
+		}
+		if (!this->backing_cache) {
+			return {};
+		}
+		std::optional<std::string> code = this->backing_cache->get(key);
+		if (code) {
+			this->insert(key, *code);
+		}
+		return code;
+	}
+
+	void LruFunctionCodeCache::put(const std::string &key, const std::string &code) {
+		if (this->backing_cache) {
+			this->backing_cache->put(key, code);
+		}
+		this->insert(key, code);
+	}
+
+	void LruFunctionCodeCache::insert(const std::string &key, const std::string &code) {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto it = this->index.find(key);
+		if (it != this->index.end()) {
+			it->second->second = code;
+			this->entries.splice(this->entries.begin(), this->entries, it->second);
+			return;
+		}
+		this->entries.emplace_front(key, code);
+		this->index.insert({key, this->entries.begin()});
+		if (this->entries.size() > this->capacity) {
+			this->index.erase(this->entries.back().first);
+			this->entries.pop_back();
+		}
+	}
+
+	// Buffered reads and writes on a connected socket.
+	class Connection {
+		private:
+
+		int fd;
+		char buffer[4096];
+		std::size_t buffer_begin;
+		std::size_t buffer_end;
+
+		public:
+
+		Connection(int fd) : fd {fd}, buffer_begin {0}, buffer_end {0} {}
+		Connection(const Connection &other) = delete;
+		~Connection() { close(this->fd); }
+
+		// Returns none at the end of the stream. Stops reading a line that
+		// is longer than max_length, so that the result is longer than
+		// max_length only if the line is.
+		std::optional<std::string> read_line(std::size_t max_length) {
+			std::string line;
+			while (true) {
+				if (this->buffer_begin == this->buffer_end && !this->fill()) {
+					return {};
+				}
+				char c = this->buffer[this->buffer_begin++];
+				if (c == '\n') {
+					return line;
+				}
+				line += c;
+				if (line.size() > max_length) {
+					return line;
+				}
+			}
+		}
+
+		// returns none if the stream ends first
+		std::optional<std::string> read_exactly(std::size_t num_bytes) {
+			std::string result;
+			result.reserve(num_bytes);
+			while (result.size() < num_bytes) {
+				if (this->buffer_begin == this->buffer_end && !this->fill()) {
+					return {};
+				}
+				std::size_t count = std::min(num_bytes - result.size(), this->buffer_end - this->buffer_begin);
+				result.append(this->buffer + this->buffer_begin, count);
+				this->buffer_begin += count;
+			}
+			return result;
+		}
+
+		bool write_all(const std::string &data) {
+			std::size_t written = 0;
+			while (written < data.size()) {
+				ssize_t count = send(this->fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+				if (count <= 0) {
+					return false;
+				}
+				written += count;
+			}
+			return true;
+		}
+
+		private:
+
+		bool fill() {
+			ssize_t count = read(this->fd, this->buffer, sizeof(this->buffer));
+			if (count <= 0) {
+				return false;
+			}
+			this->buffer_begin = 0;
+			this->buffer_end = count;
+			return true;
+		}
+	};
+
+	std::string format_response(const CompileResult &result) {
+		if (result.succeeded()) {
+			return "ok " + std::to_string(result.l1->size()) + "\n" + *result.l1;
+		}
+		std::string diagnostics;
+		for (const std::string &diagnostic : result.diagnostics) {
+			diagnostics += diagnostic + "\n";
+		}
+		return "error " + std::to_string(diagnostics.size()) + "\n" + diagnostics;
+	}
+
+	CompileResult error_result(std::string message) {
+		CompileResult result;
+		result.diagnostics.push_back(std::move(message));
+		return result;
+	}
+
+	// Parses the byte count of a source request. Returns none unless it is
+	// a plain decimal number of at most max_request_size.
+	std::optional<std::size_t> parse_request_size(const std::string &argument) {
+		std::size_t size;
+		const char *end = argument.data() + argument.size();
+		auto [parsed_end, error] = std::from_chars(argument.data(), end, size);
+		if (argument.empty() || error != std::errc() || parsed_end != end || size > max_request_size) {
+			return {};
+		}
+		return size;
+	}
+
+	// Answers requests until the client hangs up or sends a malformed
+	// request; a malformed request gets an error response before the
+	// connection is closed.
+	void serve_connection(Connection &connection, LruFunctionCodeCache &cache) {
+		while (std::optional<std::string> header = connection.read_line(max_header_length)) {
+			if (header->size() > max_header_length) {
+				connection.write_all(format_response(error_result("request header is too long")));
+				return;
+			}
+			std::size_t space = header->find(' ');
+			std::string kind = header->substr(0, space);
+			std::string argument = space == std::string::npos ? "" : header->substr(space + 1);
+
+			CompileResult result;
+			if (kind == "path") {
+				std::ifstream file(argument);
+				if (file.is_open()) {
+					std::stringstream source;
+					source << file.rdbuf();
+					result = compile(source.str(), argument, &cache);
+				} else {
+					result = error_result("could not open " + argument);
+				}
+			} else if (kind == "source") {
+				std::optional<std::size_t> size = parse_request_size(argument);
+				if (!size) {
+					connection.write_all(format_response(error_result(
+						"bad source size " + argument + "; expected at most "
+						+ std::to_string(max_request_size) + " bytes"
+					)));
+					return;
+				}
+				std::optional<std::string> source = connection.read_exactly(*size);
+				if (!source) {
+					return;
+				}
+				result = compile(*source, "<request>", &cache);
+			} else {
+				connection.write_all(format_response(error_result("unknown request " + kind)));
+				return;
+			}
+			if (!connection.write_all(format_response(result))) {
+				return;
+			}
+		}
+	}
+
+	// The accepted connections that wait for a worker. Accepting blocks
+	// while too many are waiting.
+	class ConnectionQueue {
+		private:
+
+		std::size_t capacity;
+		std::deque<int> fds;
+		std::mutex mutex;
+		std::condition_variable not_empty;
+		std::condition_variable not_full;
+
+		public:
+
+		ConnectionQueue(std::size_t capacity) : capacity {capacity} {}
+
+		void push(int fd) {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->not_full.wait(lock, [this]() { return this->fds.size() < this->capacity; });
+			this->fds.push_back(fd);
+			this->not_empty.notify_one();
+		}
+
+		int pop() {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->not_empty.wait(lock, [this]() { return !this->fds.empty(); });
+			int fd = this->fds.front();
+			this->fds.pop_front();
+			this->not_full.notify_one();
+			return fd;
+		}
+	};
+
+	int run_server(
+		const std::string &socket_path,
+		std::size_t cache_capacity,
+		int num_workers,
+		code_gen::FunctionCodeCache *backing_cache
+	) {
+		sockaddr_un address {};
+		address.sun_family = AF_UNIX;
+		if (socket_path.size() >= sizeof(address.sun_path)) {
+			std::cerr << "Error: socket path is too long: " << socket_path << std::endl;
+			return 1;
+		}
+		std::strcpy(address.sun_path, socket_path.c_str());
+
+		int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listen_fd < 0) {
+			std::cerr << "Error: could not create socket: " << std::strerror(errno) << std::endl;
+			return 1;
+		}
+		unlink(socket_path.c_str()); // left over from an earlier server
+		if (bind(listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0
+			|| listen(listen_fd, SOMAXCONN) < 0
+		) {
+			std::cerr << "Error: could not listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+			close(listen_fd);
+			return 1;
+		}
+
+		// shared by all connections
+		LruFunctionCodeCache cache(cache_capacity, backing_cache);
+		ConnectionQueue queue(num_workers);
+		// the workers live as long as the server, so that their scratch
+		// memory and the chunks of their Arenas (see arena.h) are reused
+		// from one request to the next
+		std::vector<std::thread> workers;
+		for (int i = 0; i < num_workers; ++i) {
+			workers.emplace_back([&queue, &cache]() {
+				arena::ChunkPool pool(max_pooled_arena_bytes);
+				arena::UseChunkPool use_pool(&pool);
+				while (true) {
+					Connection connection(queue.pop());
+					try {
+						serve_connection(connection, cache);
+					} catch (const std::exception &e) {
+						// e.g. out of memory; drop only this client
+						std::cerr << "Error: " << e.what() << std::endl;
+					}
+				}
+			});
+		}
+		while (true) {
+			int connection_fd = accept(listen_fd, nullptr, nullptr);
+			if (connection_fd < 0) {
+				continue;
+			}
+			queue.push(connection_fd);
+		}
+	}
+}
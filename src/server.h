@@ -0,0 +1,67 @@
+#pragma once
+
+#include "code_gen.h"
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// A long-running compile server on a Unix domain socket, so that tools
+// which compile often avoid paying process startup for every compile.
+//
+// A connection carries any number of requests, each of which is a header
+// line followed by an optional payload:
+//   path FILE_NAME\n          compile the L2 program in the named file
+//   source NUM_BYTES\n<L2>    compile the NUM_BYTES of L2 that follow
+// and each gets a response of one of the forms
+//   ok NUM_BYTES\n<L1>
+//   error NUM_BYTES\n<diagnostics>
+// A malformed header gets an error response, after which the server
+// closes the connection. Connections are served by a fixed pool of
+// worker threads; the ones beyond that wait for a worker to free up.
+namespace L2::server {
+	// the longest header line and the largest source request accepted
+	inline constexpr std::size_t max_header_length = 4096;
+	inline constexpr std::size_t max_request_size = std::size_t(256) << 20;
+	// how much Arena memory each worker keeps between requests
+	inline constexpr std::size_t max_pooled_arena_bytes = std::size_t(64) << 20;
+
+	// A bounded in-memory cache that evicts the least recently used entry.
+	class LruFunctionCodeCache : public code_gen::FunctionCodeCache {
+		private:
+
+		using Entry = std::pair<std::string, std::string>;
+
+		std::size_t capacity;
+		std::list<Entry> entries; // most recently used first
+		std::unordered_map<std::string, std::list<Entry>::iterator> index;
+		std::mutex mutex;
+		code_gen::FunctionCodeCache *backing_cache; // consulted on misses; may be null
+
+		public:
+
+		LruFunctionCodeCache(std::size_t capacity, code_gen::FunctionCodeCache *backing_cache = nullptr) :
+			capacity {capacity},
+			backing_cache {backing_cache}
+		{}
+
+		virtual std::optional<std::string> get(const std::string &key) override;
+		virtual void put(const std::string &key, const std::string &code) override;
+
+		private:
+
+		void insert(const std::string &key, const std::string &code);
+	};
+
+	// Serves requests on num_workers threads until the process is killed.
+	// Returns nonzero if the socket could not be set up.
+	int run_server(
+		const std::string &socket_path,
+		std::size_t cache_capacity,
+		int num_workers,
+		code_gen::FunctionCodeCache *backing_cache = nullptr
+	);
+}
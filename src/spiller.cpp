@@ -1,22 +1,23 @@
 #include "spiller.h"
+#include "registers.h"
 #include <iostream>
 #include <set>
 #include <string>
 #include <algorithm>
+#include <utility>
+#include <charconv>
 
 namespace L2::program::spiller {
 
 	class ExprReplaceVisitor : public ExprVisitor {
 		private:
-		std::string replace;
+		Variable *replace;
 		const Variable *target;
-		AggregateScope &agg_scope;
 
 		public:
-		ExprReplaceVisitor(AggregateScope &agg_scope, std::string replace, const Variable* target):
+		ExprReplaceVisitor(Variable *replace, const Variable* target):
 			replace{replace},
-			target {target},
-			agg_scope {agg_scope}
+			target {target}
 		{}
 
 		virtual void visit(RegisterRef &expr) {}
@@ -28,297 +29,232 @@ namespace L2::program::spiller {
 		virtual void visit(LabelRef &expr) {}
 		virtual void visit(VariableRef &expr){
 			if (expr.get_referent() == target){
-				expr.bind(agg_scope.variable_scope.get_item_or_create(replace));
+				expr.bind(replace);
 			}
 		}
 		virtual void visit(L2FunctionRef &expr) {}
 		virtual void visit(ExternalFunctionRef &expr) {}
 	};
 
+	// Rewrites each instruction that uses the spilled variable to use a fresh
+	// variable instead, and collects the loads and stores that have to go
+	// around it. It never touches the instruction list itself, so that the
+	// caller can rebuild the list in one pass.
 	class InstructionSpiller : public InstructionVisitor {
 		private:
-		L2Function &function;
+		Spiller &spiller;
 		const Variable *var;
-		std::string prefix;
 		int num_calls;
-		int prefix_count;
-		int index;
-		Register *rsp;
 
 		public:
-		InstructionSpiller(L2Function &function, const Variable *var, std::string prefix, int prefix_count, int num_calls):
-			function {function},
+		// the instructions to add before and after the one just visited
+		std::vector<std::unique_ptr<Instruction>> loads;
+		std::vector<std::unique_ptr<Instruction>> stores;
+		std::vector<Variable *> temporaries; // the Variables made so far
+
+		InstructionSpiller(Spiller &spiller, const Variable *var, int num_calls):
+			spiller {spiller},
 			var {var},
-			prefix {prefix},
-			index {0},
-			prefix_count {prefix_count},
 			num_calls {num_calls}
-		{
-			auto maybe_rsp = this->function.agg_scope.register_scope.get_item_maybe("rsp");
-			if (maybe_rsp) {
-				this->rsp = *maybe_rsp;
-			} else {
-				std::cerr << "HOLY SHIT MY ASS IS BURNING NO REGISTER FOUND RSP\n";
-				exit(-1);
-			}
-		}
+		{}
 
-		virtual void visit(InstructionReturn &inst) override {
-			index++;
-		}
+		virtual void visit(InstructionReturn &inst) override {}
 
 		virtual void visit(InstructionAssignment &inst) override {
 			// find if the source uses var
-			std::set<Variable *, std::less<void>> write_dest = inst.destination->get_vars_on_write(false);
-			bool write_dest_count = write_dest.count(var) > 0;
-			std::set<Variable *, std::less<void>> read_source = inst.source->get_vars_on_read();
-			bool read_source_count = read_source.count(var) > 0;
-			std::set<Variable *, std::less<void>> read_dest = inst.destination->get_vars_on_write(true);
-			bool read_dest_count = read_dest.count(var) > 0;
-			std::set<Variable *, std::less<void>> read_dest_update;
-			if (inst.op != AssignOperator::pure) {
-				// also reads from the destination
-				read_dest_update = inst.destination->get_vars_on_read();
-			}
-			bool read_dest_update_count = read_dest_update.count(var) > 0;
+			bool write_dest_count = inst.destination->get_vars_on_write(false).contains(var);
+			bool read_source_count = inst.source->get_vars_on_read().contains(var);
+			bool read_dest_count = inst.destination->get_vars_on_write(true).contains(var);
+			// also reads from the destination
+			bool read_dest_update_count = inst.op != AssignOperator::pure
+				&& inst.destination->get_vars_on_read().contains(var);
 
 			if (write_dest_count || read_source_count || read_dest_count || read_dest_update_count){
-				std::string new_var_name = prefix + std::to_string(prefix_count);
-				ExprReplaceVisitor v(function.agg_scope, new_var_name, var);
-				Variable *var_ptr = function.agg_scope.variable_scope.get_item_or_create(new_var_name);
-				var_ptr->spillable = false;
+				auto [var_ptr, v] = this->new_variable();
 				inst.source->accept(v);
 				inst.destination->accept(v);
-
-
 				if (read_source_count || read_dest_count || read_dest_update_count){
-					function.insert_instruction(
-						index,
-						std::make_unique<InstructionAssignment>(
-							AssignOperator::pure,
-							std::make_unique<MemoryLocation>(
-								std::make_unique<RegisterRef>(this->rsp),
-								std::make_unique<NumberLiteral>(num_calls * 8)
-							),
-							std::make_unique<VariableRef>(var_ptr)
-						)
-					);
-					index++;
+					this->add_load(var_ptr);
 				}
 				if(write_dest_count){
-					index++;
-					function.insert_instruction(
-						index,
-						std::make_unique<InstructionAssignment>(
-							AssignOperator::pure,
-							std::make_unique<VariableRef>(var_ptr),
-							std::make_unique<MemoryLocation>(
-								std::make_unique<RegisterRef>(this->rsp),
-								std::make_unique<NumberLiteral>(num_calls * 8)
-							)
-						)
-					);
+					this->add_store(var_ptr);
 				}
-				prefix_count++;
 			}
-			++index;
 		}
 
 		virtual void visit(InstructionCompareAssignment &inst) override {
-			std::set<Variable *, std::less<void>> write_dest = inst.destination->get_vars_on_write(false);
-			bool write_dest_count = write_dest.count(var) > 0;
-			std::set<Variable *, std::less<void>> read_lhs = inst.lhs->get_vars_on_read();
-			bool read_lhs_count = read_lhs.count(var) > 0;
-			std::set<Variable *, std::less<void>> read_rhs = inst.rhs->get_vars_on_read();
-			bool read_rhs_count = read_rhs.count(var) > 0;
+			bool write_dest_count = inst.destination->get_vars_on_write(false).contains(var);
+			bool read_lhs_count = inst.lhs->get_vars_on_read().contains(var);
+			bool read_rhs_count = inst.rhs->get_vars_on_read().contains(var);
 			if (write_dest_count || read_lhs_count || read_rhs_count){
-				std::string new_var_name = prefix + std::to_string(prefix_count);
-				Variable *var_ptr = function.agg_scope.variable_scope.get_item_or_create(new_var_name);
-				var_ptr->spillable = false;
-				ExprReplaceVisitor v(function.agg_scope, new_var_name, var);
+				auto [var_ptr, v] = this->new_variable();
 				inst.lhs->accept(v);
 				inst.rhs->accept(v);
 				inst.destination->accept(v);
 				if (read_lhs_count || read_rhs_count){
-					function.insert_instruction(
-						index,
-						std::make_unique<InstructionAssignment>(
-							AssignOperator::pure,
-							std::make_unique<MemoryLocation>(
-								std::make_unique<RegisterRef>(this->rsp),
-								std::make_unique<NumberLiteral>(num_calls * 8)
-							),
-							std::make_unique<VariableRef>(var_ptr)
-						)
-					);
-					index++;
+					this->add_load(var_ptr);
 				}
 				if(write_dest_count){
-					index++;
-					function.insert_instruction(
-						index,
-						std::make_unique<InstructionAssignment>(
-							AssignOperator::pure,
-							std::make_unique<VariableRef>(var_ptr),
-							std::make_unique<MemoryLocation>(
-								std::make_unique<RegisterRef>(this->rsp),
-								std::make_unique<NumberLiteral>(num_calls * 8)
-							)
-						)
-					);
+					this->add_store(var_ptr);
 				}
-				prefix_count++;
 			}
-			index++;
 		}
 
 		virtual void visit(InstructionCompareJump &inst) override {
-			std::set<Variable *, std::less<void>> read_lhs = inst.lhs->get_vars_on_read();
-			bool read_lhs_count = read_lhs.count(var) > 0;
-			std::set<Variable *, std::less<void>> read_rhs = inst.rhs->get_vars_on_read();
-			bool read_rhs_count = read_rhs.count(var) > 0;
+			bool read_lhs_count = inst.lhs->get_vars_on_read().contains(var);
+			bool read_rhs_count = inst.rhs->get_vars_on_read().contains(var);
 			if (read_lhs_count || read_rhs_count){
-				std::string new_var_name = prefix + std::to_string(prefix_count);
-				ExprReplaceVisitor v(function.agg_scope, new_var_name, var);
-				Variable *var_ptr = function.agg_scope.variable_scope.get_item_or_create(new_var_name);
-				var_ptr->spillable = false;
+				auto [var_ptr, v] = this->new_variable();
 				inst.lhs->accept(v);
 				inst.rhs->accept(v);
-				if (read_lhs_count || read_rhs_count){
-					function.insert_instruction(
-						index,
-						std::make_unique<InstructionAssignment>(
-							AssignOperator::pure,
-							std::make_unique<MemoryLocation>(
-								std::make_unique<RegisterRef>(this->rsp),
-								std::make_unique<NumberLiteral>(num_calls * 8)
-							),
-							std::make_unique<VariableRef>(var_ptr)
-						)
-					);
-					index++;
-				}
-				prefix_count++;
+				this->add_load(var_ptr);
 			}
-			++index;
 		}
 
-		virtual void visit(InstructionLabel &inst) override {
-			index++;
-		}
+		virtual void visit(InstructionLabel &inst) override {}
 
-		virtual void visit(InstructionGoto &inst) override {
-			++index;
-		}
+		virtual void visit(InstructionGoto &inst) override {}
 
 		virtual void visit(InstructionCall &inst) override {
-			std::set<Variable *, std::less<void>> read_callee = inst.callee->get_vars_on_read();
-			bool read_callee_count = read_callee.count(var) > 0;
+			bool read_callee_count = inst.callee->get_vars_on_read().contains(var);
 			if (read_callee_count){
-				std::string new_var_name = prefix + std::to_string(prefix_count);
-				Variable *var_ptr = function.agg_scope.variable_scope.get_item_or_create(new_var_name);
-				var_ptr->spillable = false;
-				ExprReplaceVisitor v(function.agg_scope, new_var_name, var);
+				auto [var_ptr, v] = this->new_variable();
 				inst.callee->accept(v);
-				function.insert_instruction(
-						index,
-						std::make_unique<InstructionAssignment>(
-							AssignOperator::pure,
-							std::make_unique<MemoryLocation>(
-								std::make_unique<RegisterRef>(this->rsp),
-								std::make_unique<NumberLiteral>(num_calls * 8)
-							),
-							std::make_unique<VariableRef>(var_ptr)
-						)
-					);
-				index++;
-				prefix_count++;
+				this->add_load(var_ptr);
 			}
-			index++;
 		}
 
 		virtual void visit(InstructionLeaq &inst) override {
-			std::set<Variable *, std::less<void>> write_dest = inst.destination->get_vars_on_write(false);
-			bool write_dest_count = write_dest.count(var) > 0;
-			std::set<Variable *, std::less<void>> read_dest = inst.destination->get_vars_on_write(true);
-			bool read_dest_count = read_dest.count(var) > 0;
-			std::set<Variable *, std::less<void>> read_base = inst.base->get_vars_on_read();
-			bool read_base_count = read_base.count(var) > 0;
-			std::set<Variable *, std::less<void>> read_offset = inst.offset->get_vars_on_read();
-			bool read_offset_count = read_offset.count(var) > 0;
+			bool write_dest_count = inst.destination->get_vars_on_write(false).contains(var);
+			bool read_dest_count = inst.destination->get_vars_on_write(true).contains(var);
+			bool read_base_count = inst.base->get_vars_on_read().contains(var);
+			bool read_offset_count = inst.offset->get_vars_on_read().contains(var);
 			if (write_dest_count || read_dest_count || read_base_count || read_offset_count){
-				std::string new_var_name = prefix + std::to_string(prefix_count);
-				Variable *var_ptr = function.agg_scope.variable_scope.get_item_or_create(new_var_name);
-				var_ptr->spillable = false;
-				ExprReplaceVisitor v(function.agg_scope, new_var_name, var);
-
+				auto [var_ptr, v] = this->new_variable();
 				inst.destination->accept(v);
 				inst.base->accept(v);
 				inst.offset->accept(v);
 				if (read_dest_count || read_base_count || read_offset_count){
-					function.insert_instruction(
-						index,
-						std::make_unique<InstructionAssignment>(
-							AssignOperator::pure,
-							std::make_unique<MemoryLocation>(
-								std::make_unique<RegisterRef>(this->rsp),
-								std::make_unique<NumberLiteral>(num_calls * 8)
-							),
-							std::make_unique<VariableRef>(var_ptr)
-						)
-					);
-					index++;
+					this->add_load(var_ptr);
 				}
 				if(write_dest_count){
-					index++;
-					function.insert_instruction(
-						index,
-						std::make_unique<InstructionAssignment>(
-							AssignOperator::pure,
-							std::make_unique<VariableRef>(var_ptr),
-							std::make_unique<MemoryLocation>(
-								std::make_unique<RegisterRef>(this->rsp),
-								std::make_unique<NumberLiteral>(num_calls * 8)
-							)
-						)
-					);
+					this->add_store(var_ptr);
 				}
-				prefix_count++;
 			}
-			++index;
 		}
 
-		int get_index(){ return index; }
+		private:
+
+		// creates the variable that replaces the spilled one in the current
+		// instruction, and a visitor that does the replacing
+		std::pair<Variable *, ExprReplaceVisitor> new_variable() {
+			Variable *var_ptr = this->spiller.new_temporary();
+			this->temporaries.push_back(var_ptr);
+			return {var_ptr, ExprReplaceVisitor(var_ptr, var)};
+		}
+
+		std::unique_ptr<MemoryLocation> make_stack_slot() {
+			return std::make_unique<MemoryLocation>(
+				std::make_unique<RegisterRef>(this->spiller.rsp),
+				std::make_unique<NumberLiteral>(num_calls * 8)
+			);
+		}
+
+		void add_load(Variable *var_ptr) {
+			this->loads.push_back(std::make_unique<InstructionAssignment>(
+				AssignOperator::pure,
+				this->make_stack_slot(),
+				std::make_unique<VariableRef>(var_ptr)
+			));
+		}
+
+		void add_store(Variable *var_ptr) {
+			this->stores.push_back(std::make_unique<InstructionAssignment>(
+				AssignOperator::pure,
+				std::make_unique<VariableRef>(var_ptr),
+				this->make_stack_slot()
+			));
+		}
 	};
-	
-	int get_next_prefix(L2Function &l2_function, std::string prefix, int start) {
-		while (true) {
-			std::string next = prefix + std::to_string(start);
-			std::optional<program::Variable *> maybe_var = l2_function.agg_scope.variable_scope.get_item_maybe(next);
-			if (!maybe_var) {
-				return start;
+
+	Spiller::Spiller(program::L2Function &function, std::string prefix):
+		function {function},
+		prefix {prefix},
+		prefix_count {0},
+		rsp {nullptr},
+		spill_calls {0}
+	{
+		// collected once, so that making a temporary never has to look up
+		// a name
+		for (const Variable *var : function.agg_scope.variable_scope.get_all_items()) {
+			std::string_view name = var->name;
+			if (name.size() <= this->prefix.size() || name.substr(0, this->prefix.size()) != this->prefix) {
+				continue;
+			}
+			std::string_view suffix = name.substr(this->prefix.size());
+			int count;
+			auto [end, error] = std::from_chars(suffix.data(), suffix.data() + suffix.size(), count);
+			// only the spellings that std::to_string makes can collide
+			if (error == std::errc() && end == suffix.data() + suffix.size() && std::to_string(count) == suffix) {
+				this->taken_counts.insert(count);
+			}
+		}
+		for (Register *reg : function.agg_scope.register_scope.get_all_items()) {
+			if (reg->id == registers::stack_pointer) {
+				this->rsp = reg;
 			}
-			start++;
 		}
+		if (!this->rsp) {
+			throw CompileError("no register rsp found");
+		}
+	}
+
+	Variable *Spiller::new_temporary() {
+		while (this->taken_counts.count(this->prefix_count)) {
+			this->prefix_count++;
+		}
+		AggregateScope &scope = this->function.agg_scope;
+		std::string_view name = scope.own_name(this->prefix + std::to_string(this->prefix_count));
+		this->prefix_count++;
+		Variable *var = scope.variable_scope.get_item_or_create(scope.get_symbols().reserve(), name);
+		var->spillable = false;
+		return var;
 	}
 
 	void Spiller::spill(const Variable *var){
-		prefix_count = get_next_prefix(function, prefix, prefix_count);
-		InstructionSpiller inst_spiller(function, var, prefix, prefix_count, spill_calls);
-		while (inst_spiller.get_index() < function.instructions.size()){
-			function.instructions[inst_spiller.get_index()]->accept(inst_spiller);
+		InstructionSpiller inst_spiller(*this, var, spill_calls);
+
+		// rebuild the body in one pass rather than inserting into it
+		std::vector<std::unique_ptr<Instruction>> old_instructions = function.take_instructions();
+		function.instructions.reserve(old_instructions.size());
+		for (std::unique_ptr<Instruction> &inst : old_instructions) {
+			inst->accept(inst_spiller);
+			// the loads and stores are made with their refs bound
+			for (std::unique_ptr<Instruction> &load : inst_spiller.loads) {
+				function.append_bound_instruction(std::move(load));
+			}
+			function.append_bound_instruction(std::move(inst));
+			for (std::unique_ptr<Instruction> &store : inst_spiller.stores) {
+				function.append_bound_instruction(std::move(store));
+			}
+			inst_spiller.loads.clear();
+			inst_spiller.stores.clear();
 		}
+		function.replace_referenced_variable(var, std::move(inst_spiller.temporaries));
 		spill_calls++;
 	}
 
 	void Spiller::spill_all(){
-		for (const Variable *var : function.agg_scope.variable_scope.get_all_items()) {
+		// spilling adds variables to the scope, but they are not in this
+		// list, which was taken before
+		std::vector<Variable *> variables = function.agg_scope.variable_scope.get_all_items();
+		for (const Variable *var : variables) {
 			spill(var);
 		}
 	}
 
 	std::string Spiller::printDaSpiller(){
-		std::string sol = "(@" + function.get_name() + "\n";
+		std::string sol = "(@" + std::string(function.get_name()) + "\n";
 		sol += "\t" + std::to_string(function.get_num_arguments());
 		sol += " " + std::to_string(spill_calls) + "\n";
 		for (const auto &inst : function.instructions) {
@@ -1,25 +1,35 @@
 #pragma once
 #include "program.h"
+#include <unordered_set>
 
 namespace L2::program::spiller {
 
+    class InstructionSpiller;
+
     class Spiller {
         private:
         program::L2Function &function;
         std::string prefix;
-        int prefix_count;
+        int prefix_count; // the number to try first for the next temporary
+        // the numbers N for which prefix + N already names a variable of the
+        // function other than the temporaries made here
+        std::unordered_set<int> taken_counts;
+        Register *rsp;
         int spill_calls;
 
         public:
-        Spiller(program::L2Function &function, std::string prefix):
-            function {function},
-            prefix {prefix},
-            prefix_count {0},
-            spill_calls {0}
-        {};
+        Spiller(program::L2Function &function, std::string prefix);
 
         void spill(const Variable *var);
         void spill_all();
         std::string printDaSpiller();
+
+        private:
+        friend class InstructionSpiller;
+
+        // creates a non-spillable variable named prefix + N with the
+        // lowest N not used yet. Its Symbol is reserved rather than
+        // interned, since nothing looks it up by name.
+        Variable *new_temporary();
     };
 }
\ No newline at end of file
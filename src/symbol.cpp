@@ -0,0 +1,28 @@
+#include "symbol.h"
+#include <stdexcept>
+
+namespace L2 {
+	Symbol SymbolTable::intern(std::string_view name) {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto it = this->symbols.find(name);
+		if (it != this->symbols.end()) {
+			return it->second;
+		}
+		Symbol symbol = this->next_symbol();
+		const std::string &stored_name = this->names.emplace_back(name);
+		this->symbols.insert({stored_name, symbol});
+		return symbol;
+	}
+
+	Symbol SymbolTable::reserve() {
+		return this->next_symbol();
+	}
+
+	Symbol SymbolTable::next_symbol() {
+		uint32_t id = this->next_id.fetch_add(1, std::memory_order_relaxed);
+		if (id == UINT32_MAX) {
+			throw std::length_error("too many names for 32-bit symbols");
+		}
+		return {id};
+	}
+}
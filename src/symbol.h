@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace L2 {
+	// An interned name, identified by a 32-bit id: two Symbols from the same
+	// SymbolTable are equal iff they were interned from the same name, so
+	// names can be compared and hashed as integers.
+	struct Symbol {
+		uint32_t id;
+
+		bool operator==(Symbol other) const { return this->id == other.id; }
+		bool operator!=(Symbol other) const { return this->id != other.id; }
+	};
+
+	// The names interned for one Program. The table is freed with the
+	// Program, so a long-running process doesn't accumulate the names of
+	// every program it has compiled. It is safe to use from several threads
+	// at once, since the functions of a Program are compiled in parallel;
+	// interning takes a lock, so callers should intern each name once (e.g.
+	// when it is parsed) and pass the Symbol around from then on.
+	class SymbolTable {
+		private:
+
+		mutable std::mutex mutex;
+		std::deque<std::string> names; // a deque so that the keys of this->symbols stay valid
+		std::unordered_map<std::string_view, Symbol> symbols; // keys are views into this->names
+		std::atomic<uint32_t> next_id;
+
+		public:
+
+		SymbolTable() : next_id {0} {}
+		SymbolTable(const SymbolTable &other) = delete;
+
+		Symbol intern(std::string_view name);
+
+		// Returns a Symbol that no name is interned as, for names that the
+		// compiler makes up and that must not be confused with any other.
+		// Doesn't take the lock.
+		Symbol reserve();
+
+		private:
+
+		Symbol next_symbol();
+	};
+}
+
+template<>
+struct std::hash<L2::Symbol> {
+	std::size_t operator()(L2::Symbol symbol) const noexcept {
+		return std::hash<uint32_t>()(symbol.id);
+	}
+};
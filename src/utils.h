@@ -3,6 +3,14 @@
 #include <string_view>
 #include <charconv>
 #include <set>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <initializer_list>
+#include <memory>
+#include <functional>
+#include <type_traits>
+#include <assert.h>
 
 namespace utils {
 	template<typename T>
@@ -18,6 +26,263 @@ namespace utils {
         return result;
     }
 
-    template<typename T>
-    using set = std::set<T, std::less<void>>;
+    // A set kept as a sorted array, with room for N elements inline so that
+    // small sets never touch the heap. Lookups are binary searches, and
+    // unions and differences are linear merges over contiguous memory. It
+    // iterates in the same order as a std::set with the same Compare. Any
+    // change invalidates iterators. Meant for pointers and integers.
+    template<typename T, std::size_t N = 8, typename Compare = std::less<void>, typename Allocator = std::allocator<T>>
+    class FlatSet {
+        static_assert(std::is_trivially_copyable_v<T>, "FlatSet copies its elements as raw memory");
+
+        private:
+        using AllocatorTraits = std::allocator_traits<Allocator>;
+
+        T inline_data[N];
+        T *elements = inline_data;
+        std::size_t count = 0;
+        std::size_t capacity = N;
+        Allocator allocator; // for elements beyond the inline ones
+
+        public:
+        using value_type = T;
+        using iterator = const T *;
+        using const_iterator = const T *;
+
+        FlatSet() = default;
+        explicit FlatSet(const Allocator &allocator) : allocator {allocator} {}
+        FlatSet(std::initializer_list<T> elements) {
+            this->insert(elements.begin(), elements.end());
+        }
+        template<typename It>
+        FlatSet(It first, It last) {
+            this->insert(first, last);
+        }
+        FlatSet(const FlatSet &other) :
+            allocator {AllocatorTraits::select_on_container_copy_construction(other.allocator)}
+        {
+            this->assign(other.begin(), other.size());
+        }
+        FlatSet(FlatSet &&other) noexcept : allocator {other.allocator} {
+            this->take(other);
+        }
+        ~FlatSet() {
+            this->release();
+        }
+
+        FlatSet &operator=(const FlatSet &other) {
+            if (this != &other) {
+                this->assign(other.begin(), other.size());
+            }
+            return *this;
+        }
+        // keeps this set's allocator, like the standard containers do by
+        // default
+        FlatSet &operator=(FlatSet &&other) {
+            if (this == &other) {
+                return *this;
+            }
+            if (this->allocator == other.allocator) {
+                this->release();
+                this->take(other);
+            } else {
+                this->assign(other.begin(), other.size());
+            }
+            return *this;
+        }
+
+        std::size_t size() const { return this->count; }
+        bool empty() const { return this->count == 0; }
+        const T *begin() const { return this->elements; }
+        const T *end() const { return this->elements + this->count; }
+        void clear() { this->count = 0; }
+
+        template<typename U>
+        const T *find(const U &value) const {
+            const T *it = std::lower_bound(this->begin(), this->end(), value, Compare());
+            if (it != this->end() && !Compare()(value, *it)) {
+                return it;
+            }
+            return this->end();
+        }
+
+        template<typename U>
+        bool contains(const U &value) const {
+            return this->find(value) != this->end();
+        }
+
+        // returns whether the value was not already in the set
+        bool insert(const T &value) {
+            const T *it = std::lower_bound(this->begin(), this->end(), value, Compare());
+            if (it != this->end() && !Compare()(value, *it)) {
+                return false;
+            }
+            std::size_t position = it - this->begin();
+            this->reserve(this->count + 1);
+            std::copy_backward(
+                this->elements + position,
+                this->elements + this->count,
+                this->elements + this->count + 1
+            );
+            this->elements[position] = value;
+            this->count += 1;
+            return true;
+        }
+
+        template<typename It>
+        void insert(It first, It last) {
+            for (; first != last; ++first) {
+                this->insert(*first);
+            }
+        }
+
+        // returns the number of elements removed
+        template<typename U>
+        std::size_t erase(const U &value) {
+            const T *it = this->find(value);
+            if (it == this->end()) {
+                return 0;
+            }
+            std::size_t position = it - this->begin();
+            std::copy(this->elements + position + 1, this->elements + this->count, this->elements + position);
+            this->count -= 1;
+            return 1;
+        }
+
+        // adds every element of other; returns whether any was new
+        bool unite(const FlatSet &other) {
+            if (other.empty()) {
+                return false;
+            }
+            if (this->empty()) {
+                *this = other;
+                return true;
+            }
+            FlatSet result(this->allocator);
+            result.reserve(this->count + other.count);
+            T *result_end = std::set_union(
+                this->begin(), this->end(),
+                other.begin(), other.end(),
+                result.elements,
+                Compare()
+            );
+            result.count = result_end - result.elements;
+            if (result.count == this->count) {
+                return false;
+            }
+            *this = std::move(result);
+            return true;
+        }
+
+        // the elements of this set that are not in other
+        FlatSet difference(const FlatSet &other) const {
+            FlatSet result(this->allocator);
+            result.reserve(this->count);
+            T *result_end = std::set_difference(
+                this->begin(), this->end(),
+                other.begin(), other.end(),
+                result.elements,
+                Compare()
+            );
+            result.count = result_end - result.elements;
+            return result;
+        }
+
+        bool operator==(const FlatSet &other) const {
+            return this->count == other.count && std::equal(this->begin(), this->end(), other.begin());
+        }
+        bool operator!=(const FlatSet &other) const {
+            return !(*this == other);
+        }
+
+        void reserve(std::size_t new_capacity) {
+            if (new_capacity <= this->capacity) {
+                return;
+            }
+            new_capacity = std::max(new_capacity, this->capacity * 2);
+            T *new_elements = AllocatorTraits::allocate(this->allocator, new_capacity);
+            std::copy(this->begin(), this->end(), new_elements);
+            if (this->elements != this->inline_data) {
+                AllocatorTraits::deallocate(this->allocator, this->elements, this->capacity);
+            }
+            this->elements = new_elements;
+            this->capacity = new_capacity;
+        }
+
+        private:
+
+        void assign(const T *data, std::size_t size) {
+            this->count = 0;
+            this->reserve(size);
+            std::copy(data, data + size, this->elements);
+            this->count = size;
+        }
+
+        // frees the heap storage, if any, and empties the set
+        void release() {
+            if (this->elements != this->inline_data) {
+                AllocatorTraits::deallocate(this->allocator, this->elements, this->capacity);
+            }
+            this->elements = this->inline_data;
+            this->capacity = N;
+            this->count = 0;
+        }
+
+        // moves other's elements into this empty set, leaving other empty;
+        // the allocators must be equal
+        void take(FlatSet &other) {
+            if (other.elements == other.inline_data) {
+                std::copy(other.begin(), other.end(), this->inline_data);
+            } else {
+                this->elements = other.elements;
+                this->capacity = other.capacity;
+                other.elements = other.inline_data;
+                other.capacity = N;
+            }
+            this->count = other.count;
+            other.count = 0;
+        }
+    };
+
+    // A vector with a fixed capacity that keeps its elements inline, for
+    // short lists returned on hot paths without touching the heap.
+    template<typename T, std::size_t N>
+    class InlineVector {
+        private:
+        T data[N] = {};
+        std::size_t count = 0;
+
+        public:
+        InlineVector() = default;
+        InlineVector(std::initializer_list<T> elements) {
+            for (const T &element : elements) {
+                this->push_back(element);
+            }
+        }
+
+        void push_back(const T &element) {
+            assert(this->count < N);
+            this->data[this->count++] = element;
+        }
+
+        template<typename U>
+        bool contains(const U &element) const {
+            return std::find(this->begin(), this->end(), element) != this->end();
+        }
+
+        std::size_t size() const { return this->count; }
+        bool empty() const { return this->count == 0; }
+        const T *begin() const { return this->data; }
+        const T *end() const { return this->data + this->count; }
+    };
+
+    // 64-bit FNV-1a; stable across runs and platforms, so usable for keys
+    // that are persisted
+    inline uint64_t fnv1a_64(std::string_view data, uint64_t hash = 14695981039346656037ull) {
+        for (char c : data) {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
 }
\ No newline at end of file
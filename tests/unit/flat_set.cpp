@@ -0,0 +1,201 @@
+// Checks utils::FlatSet's set operations, its move from inline storage to
+// the heap past N elements, and that copies and moves allocate from and
+// free to the right allocator.
+#include "utils.h"
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+	int failed = 0;
+
+	void check(bool passed, const std::string &what) {
+		if (!passed) {
+			std::cout << "  " << what << ": Failed" << std::endl;
+			failed++;
+		}
+	}
+
+	// what one CountingAllocator, and the copies of it, have handed out
+	struct Counts {
+		std::size_t allocations = 0;
+		std::size_t live = 0; // elements allocated and not freed yet
+	};
+
+	// a stateful allocator; two are equal only if they share their Counts
+	template<typename T>
+	struct CountingAllocator {
+		using value_type = T;
+
+		Counts *counts;
+
+		explicit CountingAllocator(Counts *counts) : counts {counts} {}
+		template<typename U>
+		CountingAllocator(const CountingAllocator<U> &other) : counts {other.counts} {}
+
+		T *allocate(std::size_t n) {
+			this->counts->allocations += 1;
+			this->counts->live += n;
+			return std::allocator<T>().allocate(n);
+		}
+		void deallocate(T *p, std::size_t n) {
+			this->counts->live -= n;
+			std::allocator<T>().deallocate(p, n);
+		}
+
+		bool operator==(const CountingAllocator &other) const { return this->counts == other.counts; }
+		bool operator!=(const CountingAllocator &other) const { return this->counts != other.counts; }
+	};
+
+	using Set = utils::FlatSet<int, 8, std::less<void>, CountingAllocator<int>>;
+
+	Set make_set(Counts &counts, std::initializer_list<int> elements) {
+		Set result {CountingAllocator<int>(&counts)};
+		result.insert(elements.begin(), elements.end());
+		return result;
+	}
+
+	bool has_elements(const Set &set, std::vector<int> elements) {
+		return std::vector<int>(set.begin(), set.end()) == elements;
+	}
+
+	void test_inline_to_heap() {
+		Counts counts;
+		{
+			Set set {CountingAllocator<int>(&counts)};
+			for (int i = 8; i >= 1; --i) {
+				set.insert(i);
+			}
+			check(counts.allocations == 0, "8 elements stay inline");
+			check(!set.insert(4), "insert of an element already there");
+
+			set.insert(0);
+			check(counts.allocations == 1 && counts.live >= 9, "the 9th element moves to the heap");
+			check(has_elements(set, {0, 1, 2, 3, 4, 5, 6, 7, 8}), "elements kept in order across the move");
+
+			check(set.erase(0) == 1 && set.erase(0) == 0, "erase");
+			check(has_elements(set, {1, 2, 3, 4, 5, 6, 7, 8}), "elements after erase");
+		}
+		check(counts.live == 0, "the heap storage is freed");
+	}
+
+	void test_unite() {
+		Counts counts;
+		{
+			Set set = make_set(counts, {1, 3, 5});
+			check(!set.unite(make_set(counts, {})), "unite with an empty set returns false");
+			check(!set.unite(make_set(counts, {3, 5})), "unite with a subset returns false");
+			check(has_elements(set, {1, 3, 5}), "unite with a subset keeps the set");
+			check(set.unite(make_set(counts, {2, 3})), "unite with a new element returns true");
+			check(has_elements(set, {1, 2, 3, 5}), "unite adds the new elements");
+
+			Set empty {CountingAllocator<int>(&counts)};
+			check(empty.unite(set), "unite into an empty set returns true");
+			check(empty == set, "unite into an empty set copies");
+
+			std::size_t allocations = counts.allocations;
+			check(set.unite(make_set(counts, {4, 6, 7, 8, 9})), "unite across N returns true");
+			check(counts.allocations > allocations, "unite across N allocates");
+			check(has_elements(set, {1, 2, 3, 4, 5, 6, 7, 8, 9}), "unite across N");
+			check(!set.unite(make_set(counts, {1, 9})), "unite with a subset of a heap set returns false");
+		}
+		check(counts.live == 0, "unite frees what it allocates");
+	}
+
+	void test_difference() {
+		Counts counts;
+		{
+			Set set = make_set(counts, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10});
+			check(has_elements(set.difference(make_set(counts, {2, 4, 6, 8, 10, 12})), {1, 3, 5, 7, 9}), "difference");
+			check(set.difference(make_set(counts, {})) == set, "difference with an empty set");
+			check(set.difference(make_set(counts, {11, 12})) == set, "difference with a disjoint set");
+			check(set.difference(set).empty(), "difference with itself");
+			check(make_set(counts, {}).difference(set).empty(), "difference of an empty set");
+
+			Counts other_counts;
+			Set other = make_set(other_counts, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11});
+			std::size_t allocations = counts.allocations;
+			Set result = set.difference(other);
+			check(result.empty(), "difference with a superset");
+			check(counts.allocations > allocations, "difference allocates from this set's allocator");
+		}
+		check(counts.live == 0, "difference frees what it allocates");
+	}
+
+	void test_copy() {
+		Counts counts;
+		Counts other_counts;
+		{
+			Set heap = make_set(counts, {1, 2, 3, 4, 5, 6, 7, 8, 9});
+			Set copy(heap);
+			check(copy == heap && has_elements(heap, {1, 2, 3, 4, 5, 6, 7, 8, 9}), "copy constructor");
+
+			Set small = make_set(other_counts, {10});
+			std::size_t allocations = other_counts.allocations;
+			small = heap;
+			check(small == heap, "copy assignment from a heap set");
+			check(other_counts.allocations == allocations + 1, "copy assignment allocates from its own allocator");
+
+			Set few = make_set(counts, {11, 12});
+			small = few;
+			check(has_elements(small, {11, 12}), "copy assignment of fewer elements");
+		}
+		check(counts.live == 0 && other_counts.live == 0, "copies free to their own allocator");
+	}
+
+	void test_move() {
+		Counts counts;
+		Counts other_counts;
+		{
+			// equal allocators: the heap storage moves with the elements
+			Set heap = make_set(counts, {1, 2, 3, 4, 5, 6, 7, 8, 9});
+			std::size_t allocations = counts.allocations;
+			Set moved(std::move(heap));
+			check(has_elements(moved, {1, 2, 3, 4, 5, 6, 7, 8, 9}), "move constructor from a heap set");
+			check(counts.allocations == allocations, "move constructor takes the heap storage");
+			check(heap.empty(), "move constructor empties the source");
+
+			Set small = make_set(counts, {1});
+			Set inline_moved(std::move(small));
+			check(has_elements(inline_moved, {1}) && small.empty(), "move constructor from an inline set");
+
+			Set target = make_set(counts, {20, 21, 22, 23, 24, 25, 26, 27, 28});
+			target = std::move(moved);
+			check(has_elements(target, {1, 2, 3, 4, 5, 6, 7, 8, 9}), "move assignment between equal allocators");
+			check(counts.allocations == allocations + 1, "move assignment takes the heap storage");
+			check(moved.empty(), "move assignment empties the source");
+
+			target = std::move(inline_moved);
+			check(has_elements(target, {1}) && inline_moved.empty(), "move assignment from an inline set");
+			for (int i = 2; i <= 9; ++i) {
+				target.insert(i);
+			}
+			check(target.size() == 9, "a set moved into can grow again");
+
+			// unequal allocators: the elements are copied into storage from
+			// the target's own allocator
+			Set other = make_set(other_counts, {30});
+			Set source = make_set(counts, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10});
+			allocations = other_counts.allocations;
+			other = std::move(source);
+			check(has_elements(other, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10}), "move assignment between unequal allocators");
+			check(other_counts.allocations == allocations + 1, "move assignment between unequal allocators allocates from the target's");
+
+			Set other_small = make_set(other_counts, {40});
+			Set inline_source = make_set(counts, {41, 42});
+			other_small = std::move(inline_source);
+			check(has_elements(other_small, {41, 42}), "move assignment of an inline set between unequal allocators");
+		}
+		check(counts.live == 0 && other_counts.live == 0, "moves free to the allocator that allocated");
+	}
+}
+
+int main() {
+	test_inline_to_heap();
+	test_unite();
+	test_difference();
+	test_copy();
+	test_move();
+	return failed == 0 ? 0 : 1;
+}
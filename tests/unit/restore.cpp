@@ -0,0 +1,107 @@
+// Checks that when allocation gets stuck, restoring the snapshot taken
+// before the first spill and spilling everything gives the same function
+// and registers as spilling everything from the start.
+#include "parser.h"
+#include "register_allocator.h"
+#include "spiller.h"
+#include <iostream>
+
+using namespace L2::program;
+
+namespace {
+	// All nine variables are live to the end, along with rax and the six
+	// callee-saved registers, and the shift needs %v7 in rcx. Spilling one
+	// variable at a time gets stuck here, so the backup path is taken.
+	const std::string source = R"(
+(@main
+	(@main
+		0
+		%v0 <- 1
+		%v1 <- 21
+		%v2 <- 29
+		%v3 <- 7
+		%v4 <- 11
+		%v5 <- 37
+		%v6 <- 3
+		%v7 <- 6
+		%v8 <- 22
+		%v4 <<= %v7
+		%v5 += %v1
+		%v4 <- mem %v2 24
+		%v2 <- mem %v2 16
+		%v2 <- mem %v1 0
+		rax <- %v5
+		rax += %v0
+		rax += %v1
+		rax += %v2
+		rax += %v3
+		rax += %v4
+		rax += %v5
+		rax += %v6
+		rax += %v7
+		rax += %v8
+		return
+	)
+)
+)";
+
+	int failed = 0;
+
+	void check(bool passed, const std::string &what) {
+		if (!passed) {
+			std::cout << "  " << what << ": Failed" << std::endl;
+			failed++;
+		}
+	}
+
+	// the function's instructions followed by the register of each variable
+	std::string describe(const L2Function &function, const analyze::RegAllocMap &reg_alloc) {
+		std::string result;
+		for (const std::unique_ptr<Instruction> &inst : function.instructions) {
+			result += inst->to_string() + "\n";
+		}
+		for (const Register *reg : reg_alloc) {
+			result += reg ? std::string(reg->name) : "-";
+			result += "\n";
+		}
+		return result;
+	}
+
+	std::string spill_all(L2Function &function) {
+		spiller::Spiller spill_man(function, "S");
+		return describe(function, analyze::allocate_and_spill_all(function, spill_man));
+	}
+}
+
+int main() {
+	std::unique_ptr<Program> fresh_program = L2::parser::parse_program(source, "fresh");
+	L2Function &fresh = *fresh_program->get_l2_function(0);
+	std::size_t num_variables = fresh.agg_scope.variable_scope.size();
+	std::string expected = spill_all(fresh);
+
+	std::unique_ptr<Program> program = L2::parser::parse_program(source, "restored");
+	L2Function &function = *program->get_l2_function(0);
+	std::optional<L2FunctionSnapshot> backup;
+	spiller::Spiller spill_man(function, "S");
+	check(!analyze::allocate_and_spill(function, spill_man, &backup), "allocation gets stuck");
+	check(backup.has_value(), "snapshot taken before the first spill");
+	if (!backup) {
+		return 1;
+	}
+	check(function.agg_scope.variable_scope.size() > num_variables, "spilling adds temporaries");
+
+	function.restore(*backup);
+	check(function.agg_scope.variable_scope.size() == num_variables, "restore removes the temporaries");
+	for (Variable *var : function.agg_scope.variable_scope.get_all_items()) {
+		var->spillable = true;
+	}
+	check(spill_all(function) == expected, "snapshot, spill, restore, then spill_all");
+
+	// and the same again through the allocator's own backup path
+	std::unique_ptr<Program> backup_program = L2::parser::parse_program(source, "backup");
+	L2Function &backup_function = *backup_program->get_l2_function(0);
+	analyze::RegAllocMap reg_alloc = analyze::allocate_and_spill_with_backup(backup_function);
+	check(describe(backup_function, reg_alloc) == expected, "allocate_and_spill_with_backup");
+
+	return failed == 0 ? 0 : 1;
+}